@@ -0,0 +1,63 @@
+/* alloc_counter.hpp
+* Counting replacements of the global operator new and delete for the benchmarks.
+*
+* Every form, array and sized ones included, goes through malloc() and free(), so
+* each allocation is released by the matching call. g_allocations counts calls to
+* operator new and g_allocated_bytes the bytes asked for. Include it from exactly
+* one translation unit: the replacements are definitions.
+*
+* They stay out of line: inlined into a caller, GCC pairs the malloc() or free()
+* inside with the builtin operator on the other side and reports a mismatch
+* (-Wmismatched-new-delete).
+*/
+
+#ifndef __SOCKET_IO_ALLOC_COUNTER_HPP__
+#define __SOCKET_IO_ALLOC_COUNTER_HPP__
+
+#include <cstdlib>
+#include <new>
+
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+static std::size_t g_allocations = 0;
+static std::size_t g_allocated_bytes = 0;
+
+BENCH_NOINLINE void* operator new(std::size_t size)
+{
+   ++g_allocations;
+   g_allocated_bytes += size;
+   void* p = std::malloc(size ? size : 1);
+   if (!p) throw std::bad_alloc();
+   return p;
+}
+
+BENCH_NOINLINE void* operator new[](std::size_t size)
+{
+   return operator new(size);
+}
+
+BENCH_NOINLINE void operator delete(void* p) noexcept
+{
+   std::free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p) noexcept
+{
+   std::free(p);
+}
+
+BENCH_NOINLINE void operator delete(void* p, std::size_t) noexcept
+{
+   std::free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p, std::size_t) noexcept
+{
+   std::free(p);
+}
+
+#endif // __SOCKET_IO_ALLOC_COUNTER_HPP__
@@ -0,0 +1,254 @@
+/* connect_bench.cpp
+* Reconnect time with and without handshake keep-alive over a link with injected
+* delay. A local TCP proxy holds every chunk for the given one-way delay before
+* forwarding it, so each round trip costs twice the delay on loopback. To force a
+* reconnect the proxy drops the websocket connection only; a kept-alive handshake
+* connection survives and is reused. Keep-alive saves the TCP setup of the
+* handshake connection, one round trip; the websocket upgrade still opens a
+* connection of its own in both modes.
+*
+* Usage: connect_bench <server host> <server port> [one-way delay ms] [connects]
+* Start a server first, e.g. `node examples/test.js`.
+*/
+
+#include <socket_io_client.hpp>
+#include <socket_io_client_pool.hpp>
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using socketio::socketio_client_handler;
+using boost::asio::ip::tcp;
+
+namespace {
+
+   // Both ends of one proxied connection.
+   struct proxied_link
+   {
+      proxied_link(std::shared_ptr<tcp::socket> client, std::shared_ptr<tcp::socket> server) : client(client), server(server), websocket(false)
+      {}
+
+      std::shared_ptr<tcp::socket> client;
+      std::shared_ptr<tcp::socket> server;
+      // The client opened it with a GET, i.e. the websocket upgrade; the handshake is a POST.
+      bool websocket;
+   };
+
+   // Relays one direction of a proxied connection, delaying every chunk.
+   class delayed_pipe : public std::enable_shared_from_this<delayed_pipe>
+   {
+   public:
+      // link is set on the client to server direction, to mark websocket connections.
+      delayed_pipe(boost::asio::io_service& io_service, std::shared_ptr<tcp::socket> from, std::shared_ptr<tcp::socket> to, std::chrono::milliseconds delay,
+         std::shared_ptr<proxied_link> link = std::shared_ptr<proxied_link>()) :
+         m_from(from), m_to(to), m_delay(delay), m_timer(io_service), m_link(link)
+      {}
+
+      void start()
+      {
+         std::shared_ptr<delayed_pipe> self = shared_from_this();
+         m_from->async_read_some(boost::asio::buffer(m_buffer), [self](const boost::system::error_code& ec, std::size_t bytes) {
+            if (ec)
+            {
+               boost::system::error_code ignored;
+               self->m_to->shutdown(tcp::socket::shutdown_send, ignored);
+               return;
+            }
+            if (self->m_link)
+            {
+               self->m_link->websocket = bytes >= 4 && std::string(self->m_buffer, 4) == "GET ";
+               self->m_link.reset();
+            }
+            self->m_timer.expires_from_now(self->m_delay);
+            self->m_timer.async_wait([self, bytes](const boost::system::error_code&) {
+               boost::asio::async_write(*self->m_to, boost::asio::buffer(self->m_buffer, bytes), [self](const boost::system::error_code& ec, std::size_t) {
+                  if (!ec) self->start();
+               });
+            });
+         });
+      }
+
+   private:
+      std::shared_ptr<tcp::socket> m_from;
+      std::shared_ptr<tcp::socket> m_to;
+      std::chrono::milliseconds m_delay;
+      boost::asio::steady_timer m_timer;
+      std::shared_ptr<proxied_link> m_link;
+      char m_buffer[16384];
+   };
+
+   class delay_proxy
+   {
+   public:
+      delay_proxy(boost::asio::io_service& io_service, const std::string& host, const std::string& port, std::chrono::milliseconds delay) :
+         m_io_service(io_service),
+         m_acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+         m_delay(delay)
+      {
+         tcp::resolver resolver(io_service);
+         m_upstream = *resolver.resolve(tcp::resolver::query(host, port));
+         accept();
+      }
+
+      unsigned short port() const { return m_acceptor.local_endpoint().port(); }
+
+      // Closes the websocket connections, which makes the client reconnect.
+      void drop_websockets()
+      {
+         m_io_service.post([this]() {
+            std::vector<std::shared_ptr<proxied_link> > kept;
+            for (std::size_t i = 0; i < m_links.size(); ++i)
+            {
+               if (!m_links[i]->websocket)
+               {
+                  kept.push_back(m_links[i]);
+                  continue;
+               }
+               boost::system::error_code ignored;
+               m_links[i]->client->close(ignored);
+               m_links[i]->server->close(ignored);
+            }
+            m_links.swap(kept);
+         });
+      }
+
+   private:
+      void accept()
+      {
+         std::shared_ptr<tcp::socket> client(new tcp::socket(m_io_service));
+         m_acceptor.async_accept(*client, [this, client](const boost::system::error_code& ec) {
+            if (ec) return;
+            std::shared_ptr<tcp::socket> server(new tcp::socket(m_io_service));
+            std::chrono::milliseconds delay = m_delay;
+            // The TCP handshake to the server crosses the link too.
+            std::shared_ptr<boost::asio::steady_timer> timer(new boost::asio::steady_timer(m_io_service, 2 * delay));
+            timer->async_wait([this, client, server, delay, timer](const boost::system::error_code&) {
+               server->async_connect(m_upstream, [this, client, server, delay](const boost::system::error_code& ec) {
+                  if (ec) return;
+                  std::shared_ptr<proxied_link> link(new proxied_link(client, server));
+                  m_links.push_back(link);
+                  std::make_shared<delayed_pipe>(m_io_service, client, server, delay, link)->start();
+                  std::make_shared<delayed_pipe>(m_io_service, server, client, delay)->start();
+               });
+            });
+            accept();
+         });
+      }
+
+      boost::asio::io_service& m_io_service;
+      tcp::acceptor m_acceptor;
+      tcp::endpoint m_upstream;
+      std::chrono::milliseconds m_delay;
+      // Connections proxied so far; only touched on m_io_service.
+      std::vector<std::shared_ptr<proxied_link> > m_links;
+   };
+
+   class waiting_listener : public socketio_client_handler::connection_listener
+   {
+   public:
+      waiting_listener() : m_events(0) {}
+      void on_fail(websocketpp::connection_hdl) { signal(); }
+      void on_open(websocketpp::connection_hdl) { signal(); }
+      void on_close(websocketpp::connection_hdl) { signal(); }
+
+      // Waits for the next open, close or fail.
+      void wait()
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         m_cond.wait(lock, [this]() { return m_events > 0; });
+         --m_events;
+      }
+
+   private:
+      void signal()
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         ++m_events;
+         m_cond.notify_one();
+      }
+
+      std::mutex m_mutex;
+      std::condition_variable m_cond;
+      int m_events;
+   };
+
+   void run(socketio::socketio_client_pool& pool, delay_proxy& proxy, const std::string& uri, bool keep_alive, int connects)
+   {
+      waiting_listener listener;
+      socketio_client_handler handler(pool);
+      handler.set_connection_listener(&listener);
+      handler.set_handshake_keep_alive(keep_alive);
+      // Reconnect at once, so time_to_connected is the reconnect alone. close() would close
+      // the kept handshake connection too.
+      handler.set_reconnect(true);
+      handler.set_reconnect_delay(boost::posix_time::milliseconds(0), boost::posix_time::milliseconds(0), 0);
+
+      std::vector<long long> samples;
+      handler.connect(uri);
+      for (int i = 0; i < connects; ++i)
+      {
+         if (i > 0)
+         {
+            proxy.drop_websockets();
+            // The close, then the reconnect's open.
+            listener.wait();
+            listener.wait();
+         }
+         else listener.wait();
+         if (!handler.connected())
+         {
+            std::cerr << "connect failed" << std::endl;
+            return;
+         }
+         samples.push_back(handler.time_to_connected().count());
+      }
+      handler.close();
+      listener.wait();
+
+      // The first connect always pays for DNS and a fresh handshake connection.
+      std::sort(samples.begin() + 1, samples.end());
+      std::cout << (keep_alive ? "keep-alive" : "close     ")
+         << " first: " << samples[0] / 1000.0 << "ms"
+         << "  reconnect median: " << samples[1 + (samples.size() - 1) / 2] / 1000.0 << "ms" << std::endl;
+   }
+
+}
+
+int main(int argc, char* argv[])
+{
+   if (argc < 3)
+   {
+      std::cerr << "Usage: " << argv[0] << " <server host> <server port> [one-way delay ms] [connects]" << std::endl;
+      return 1;
+   }
+   std::chrono::milliseconds delay(argc > 3 ? std::atoi(argv[3]) : 25);
+   int connects = std::max(argc > 4 ? std::atoi(argv[4]) : 20, 2);
+
+   boost::asio::io_service proxy_service;
+   delay_proxy proxy(proxy_service, argv[1], argv[2], delay);
+   std::thread proxy_thread([&proxy_service]() { proxy_service.run(); });
+
+   std::ostringstream uri;
+   uri << "ws://127.0.0.1:" << proxy.port();
+   std::cout << "one-way delay " << delay.count() << "ms, " << connects << " connects" << std::endl;
+
+   socketio::socketio_client_pool pool(1);
+   run(pool, proxy, uri.str(), false, connects);
+   run(pool, proxy, uri.str(), true, connects);
+   pool.stop();
+
+   proxy_service.stop();
+   proxy_thread.join();
+   return 0;
+}
@@ -0,0 +1,226 @@
+/* e2e_bench.cpp
+* End-to-end throughput and latency against the loopback mock server: emit
+* throughput, event-receive throughput and ack round-trip percentiles, for
+* message sizes from 32 B to 1 MB and 1 to N concurrent sessions. Runs offline;
+* no Node server is needed.
+*
+* Usage: e2e_bench [max sessions] [events per session] [round trips per session]
+*/
+
+#include <socket_io_client.hpp>
+#include <socket_io_client_pool.hpp>
+
+#include "mock_server.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using socketio::socketio_client_handler;
+
+namespace {
+
+   typedef std::chrono::steady_clock clock_type;
+
+   // Counts down to zero from any thread.
+   class latch
+   {
+   public:
+      explicit latch(int count = 0) : m_count(count) {}
+
+      void reset(int count)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_count = count;
+      }
+
+      void count_down()
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         if (m_count > 0 && --m_count == 0) m_cond.notify_all();
+      }
+
+      void wait()
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         m_cond.wait(lock, [this]() { return m_count == 0; });
+      }
+
+   private:
+      std::mutex m_mutex;
+      std::condition_variable m_cond;
+      int m_count;
+   };
+
+   class session : public socketio_client_handler::connection_listener
+   {
+   public:
+      session(socketio::socketio_client_pool& pool, latch& opened, latch& closed, latch& received) :
+         handler(pool), m_opened(opened), m_closed(closed), m_received(received), m_count(0), m_target(0)
+      {
+         handler.set_connection_listener(this);
+         handler.on("data", [this](const std::string&, const rapidjson::Value&, std::string*) {
+            if (++m_count == m_target) m_received.count_down();
+         });
+      }
+
+      void on_fail(websocketpp::connection_hdl) { m_opened.count_down(); }
+      void on_open(websocketpp::connection_hdl) { m_opened.count_down(); }
+      void on_close(websocketpp::connection_hdl) { m_closed.count_down(); }
+
+      // Asks the server for count "data" events of size bytes; the received latch counts
+      // down once they have all arrived.
+      void flood(unsigned long count, std::size_t size)
+      {
+         m_count = 0;
+         m_target = count;
+         std::ostringstream arg;
+         arg << count << ":" << size;
+         handler.emit("flood", arg.str());
+      }
+
+      socketio_client_handler handler;
+
+   private:
+      latch& m_opened;
+      latch& m_closed;
+      latch& m_received;
+      std::atomic<unsigned long> m_count;
+      std::atomic<unsigned long> m_target;
+   };
+
+   double seconds_since(clock_type::time_point start)
+   {
+      return std::chrono::duration<double>(clock_type::now() - start).count();
+   }
+
+   // Events per session for one phase: at most events, and about 64 MiB over all sessions.
+   unsigned long events_for(std::size_t size, std::size_t sessions, unsigned long events)
+   {
+      unsigned long budget = (unsigned long)((64ul << 20) / size / sessions);
+      return std::max(4ul, std::min(events, budget));
+   }
+
+   void run(socketio::socketio_client_pool& pool, const std::string& uri, std::size_t sessions, unsigned long events, unsigned long round_trips)
+   {
+      latch opened(static_cast<int>(sessions));
+      latch closed(static_cast<int>(sessions));
+      latch received;
+      std::vector<std::unique_ptr<session> > clients;
+      for (std::size_t i = 0; i < sessions; ++i)
+      {
+         clients.push_back(std::unique_ptr<session>(new session(pool, opened, closed, received)));
+         clients.back()->handler.connect(uri);
+      }
+      opened.wait();
+      for (std::size_t i = 0; i < sessions; ++i)
+      {
+         if (!clients[i]->handler.connected())
+         {
+            std::cerr << "session " << i << " failed to connect" << std::endl;
+            std::exit(1);
+         }
+      }
+
+      static const std::size_t sizes[] = { 32, 1024, 32 * 1024, 1024 * 1024 };
+      for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+      {
+         std::size_t size = sizes[s];
+         std::string payload(size, 'x');
+         unsigned long count = events_for(size, sessions, events);
+
+         // Emit throughput: everything is queued, then a final acked emit on each session
+         // returns once the server has read all of that session's events.
+         latch synced(static_cast<int>(sessions));
+         clock_type::time_point start = clock_type::now();
+         for (unsigned long e = 0; e < count; ++e)
+         {
+            for (std::size_t i = 0; i < sessions; ++i) clients[i]->handler.emit("bench", payload);
+         }
+         for (std::size_t i = 0; i < sessions; ++i)
+         {
+            clients[i]->handler.emit("sync", "", "", [&synced]() { synced.count_down(); });
+         }
+         synced.wait();
+         double emit_seconds = seconds_since(start);
+
+         // Receive throughput.
+         received.reset(int(sessions));
+         start = clock_type::now();
+         for (std::size_t i = 0; i < sessions; ++i) clients[i]->flood(count, size);
+         received.wait();
+         double receive_seconds = seconds_since(start);
+
+         // Ack round trips: one emit in flight per session at a time.
+         std::string name = "rtt_" + std::to_string(size);
+         unsigned long trips = std::min(round_trips, count);
+         std::vector<std::thread> threads;
+         for (std::size_t i = 0; i < sessions; ++i)
+         {
+            socketio_client_handler* handler = &clients[i]->handler;
+            threads.push_back(std::thread([handler, &name, &payload, trips]() {
+               latch acked;
+               for (unsigned long t = 0; t < trips; ++t)
+               {
+                  acked.reset(1);
+                  handler->emit(name, payload, "", [&acked]() { acked.count_down(); });
+                  acked.wait();
+               }
+            }));
+         }
+         for (std::size_t i = 0; i < threads.size(); ++i) threads[i].join();
+         socketio::latency_histogram rtt;
+         for (std::size_t i = 0; i < sessions; ++i) rtt.merge(clients[i]->handler.ack_latency(name));
+
+         double total = double(count) * double(sessions);
+         double megabytes = total * double(size) / (1024.0 * 1024.0);
+         char line[256];
+         std::snprintf(line, sizeof(line), "%8zu %8zu %12.0f %9.1f %12.0f %9.1f %9llu %9llu %9llu",
+            sessions, size,
+            total / emit_seconds, megabytes / emit_seconds,
+            total / receive_seconds, megabytes / receive_seconds,
+            (unsigned long long)rtt.p50(), (unsigned long long)rtt.p99(), (unsigned long long)rtt.p999());
+         std::cout << line << std::endl;
+      }
+
+      // The handlers must not go away before their io thread is done with them.
+      for (std::size_t i = 0; i < sessions; ++i) clients[i]->handler.close();
+      closed.wait();
+   }
+
+}
+
+int main(int argc, char* argv[])
+{
+   std::size_t max_sessions = argc > 1 ? std::atoi(argv[1]) : 16;
+   unsigned long events = argc > 2 ? std::atol(argv[2]) : 100000;
+   unsigned long round_trips = argc > 3 ? std::atol(argv[3]) : 2000;
+   if (max_sessions == 0) max_sessions = 1;
+
+   std::size_t threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+   socketio_bench::mock_server server(0, threads);
+   std::ostringstream uri;
+   uri << "ws://127.0.0.1:" << server.port();
+
+   socketio::socketio_client_pool pool(threads);
+   std::cout << "sessions     size   emit ev/s  emit MB/s   recv ev/s  recv MB/s  rtt p50us  rtt p99us rtt p999us" << std::endl;
+   for (std::size_t sessions = 1; ; sessions *= 4)
+   {
+      if (sessions > max_sessions) sessions = max_sessions;
+      run(pool, uri.str(), sessions, events, round_trips);
+      if (sessions == max_sessions) break;
+   }
+   pool.stop();
+   server.stop();
+   return 0;
+}
@@ -0,0 +1,132 @@
+/* encode_bench.cpp
+* Allocations and ns per emit for the previous stringstream based encoding, for
+* packet_encoder with a Document and for packet_encoder with event_args, the latter
+* also with a namespace's own packet_prefixes. Needs only rapidjson and
+* socket_io_packet.hpp.
+*
+* Usage: encode_bench [iterations]
+*/
+
+#include <socket_io_packet.hpp>
+
+#include "alloc_counter.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace rapidjson;
+
+namespace {
+
+   // The encoding path emit() used before packet_encoder: name added to the caller's
+   // Document, serialised through an ostringstream, copied out, trimmed, then framed
+   // through a second stringstream with by-value arguments.
+   std::string legacy_send(unsigned int type, std::string endpoint, std::string msg, unsigned int id)
+   {
+      std::stringstream package;
+      package << type << ":";
+      if (id > 0) package << id;
+      package << ":" << endpoint << ":" << msg;
+      return package.str();
+   }
+
+   std::string legacy_emit(std::string const& name, Document& args, std::string const& endpoint)
+   {
+      Value n;
+      n.SetString(name.c_str(), name.length(), args.GetAllocator());
+      args.AddMember("name", n, args.GetAllocator());
+
+      std::ostringstream outStream;
+      outStream.precision(8);
+      StreamWriter<std::ostringstream> writer(outStream);
+      args.Accept(writer);
+
+      std::string package(outStream.str());
+      std::string packet = legacy_send(socketio::type_event, endpoint, package.substr(0, package.find('\0')), 0);
+      args.RemoveMember("name");
+      return packet;
+   }
+
+   void make_args(Document& d)
+   {
+      d.SetObject();
+      Value args;
+      args.SetArray();
+      args.PushBack("hello world", d.GetAllocator());
+      args.PushBack(42, d.GetAllocator());
+      Value obj;
+      obj.SetObject();
+      obj.AddMember("x", 1.5, d.GetAllocator());
+      obj.AddMember("y", "label", d.GetAllocator());
+      args.PushBack(obj, d.GetAllocator());
+      d.AddMember("args", args, d.GetAllocator());
+   }
+
+   // The same arguments as make_args, for event_args.
+   struct point { double x; std::string y; };
+   SOCKETIO_STRUCT(point, (x)(y))
+
+   template <typename Func>
+   void run(const char* label, int iterations, Func func)
+   {
+      std::size_t bytes = 0;
+      // Warm up caches and the encoder's prefix cache.
+      for (int i = 0; i < 1000; ++i) bytes += func().size();
+
+      std::size_t allocations = g_allocations;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations; ++i) bytes += func().size();
+      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+      allocations = g_allocations - allocations;
+
+      double ns = std::chrono::duration<double, std::nano>(end - start).count();
+      std::cout << label << ": " << ns / iterations << " ns/emit, "
+                << double(allocations) / iterations << " allocations/emit"
+                << " (" << bytes << " bytes)" << std::endl;
+   }
+
+}
+
+int main(int argc, char* argv[])
+{
+   int iterations = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+   Document d;
+   make_args(d);
+   const std::string name("position");
+   const std::string endpoint("/chat");
+
+   std::cout << "sample: " << legacy_emit(name, d, endpoint) << std::endl;
+
+   run("stringstream", iterations, [&]() {
+      return legacy_emit(name, d, endpoint);
+   });
+
+   socketio::packet_encoder encoder;
+   run("packet_encoder", iterations, [&]() {
+      std::string packet;
+      encoder.encode_event(packet, endpoint, name, d, 0);
+      return packet;
+   });
+
+   const std::string text("hello world");
+   const point p = { 1.5, "label" };
+   run("event_args", iterations, [&]() {
+      std::string packet;
+      encoder.encode_event(packet, endpoint, name, socketio::args(text, 42, p), 0);
+      return packet;
+   });
+
+   // What socketio_namespace::emit does: no lookup in the encoder's cache.
+   const socketio::packet_prefixes prefixes(endpoint);
+   run("event_args, namespace prefixes", iterations, [&]() {
+      std::string packet;
+      encoder.encode_event(packet, prefixes, name, socketio::args(text, 42, p), 0);
+      return packet;
+   });
+
+   return 0;
+}
@@ -0,0 +1,143 @@
+/* json_bench.cpp
+* Event payload parsing: a fresh Document with Parse<0> per message (the default
+* path), insitu_json_parser, scan_event streaming args into an
+* event_stream_listener, and dropping the event by its name alone as the handler
+* does when nobody subscribed to it. Needs only rapidjson, socket_io_json.hpp and
+* socket_io_event_stream.hpp.
+*
+* Usage: json_bench [iterations]
+*/
+
+#include <socket_io_json.hpp>
+#include <socket_io_event_stream.hpp>
+#include <socket_io_dispatch.hpp>
+
+#include "alloc_counter.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace rapidjson;
+
+// Keeps the results alive, so work that doesn't allocate isn't optimised away.
+static volatile std::size_t g_sink = 0;
+
+namespace {
+
+   struct payload
+   {
+      const char* label;
+      std::string json;
+   };
+
+   std::string order_book(int levels)
+   {
+      std::string s("{\"name\":\"book\",\"args\":[{\"symbol\":\"BTC-USD\",\"seq\":918273645,\"bids\":[");
+      for (int i = 0; i < levels; ++i)
+      {
+         if (i) s += ",";
+         s += "[\"" + std::to_string(27000 - i) + ".50\",\"" + std::to_string(i + 1) + ".25\"]";
+      }
+      s += "],\"asks\":[";
+      for (int i = 0; i < levels; ++i)
+      {
+         if (i) s += ",";
+         s += "[\"" + std::to_string(27001 + i) + ".00\",\"0." + std::to_string(i + 10) + "\"]";
+      }
+      s += "]}]}";
+      return s;
+   }
+
+   // Reads what a market-data consumer would: the numbers, and how many args there were.
+   class summing_listener : public socketio::event_stream_listener
+   {
+   public:
+      summing_listener() : depth(0), args(0), sum(0)
+      {}
+
+      void Int(int i) { sum += i; }
+      void Uint(unsigned i) { sum += i; }
+      void Int64(boost::int64_t i) { sum += double(i); }
+      void Uint64(boost::uint64_t i) { sum += double(i); }
+      void Double(double d) { sum += d; }
+      void StartObject() { ++depth; }
+      void EndObject(SizeType) { --depth; }
+      void StartArray() { ++depth; }
+      void EndArray(SizeType count) { if (--depth == 0) args = count; }
+
+      int depth;
+      std::size_t args;
+      double sum;
+   };
+
+   // Only operator new is counted; rapidjson's pool chunks come from malloc behind it.
+   template <typename Func>
+   void run(const char* label, const std::string& json, int iterations, Func func)
+   {
+      std::size_t members = 0;
+      for (int i = 0; i < 1000; ++i) members += func(json);
+
+      std::size_t allocations = g_allocations;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations; ++i) members += func(json);
+      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+      allocations = g_allocations - allocations;
+      g_sink = members;
+
+      double ns = std::chrono::duration<double, std::nano>(end - start).count();
+      std::cout << "  " << label << ": " << ns / iterations << " ns/msg, "
+                << double(allocations) / iterations << " operator new/msg" << std::endl;
+   }
+
+}
+
+int main(int argc, char* argv[])
+{
+   int iterations = argc > 1 ? std::atoi(argv[1]) : 200000;
+
+   payload payloads[] = {
+      { "chat message", "{\"name\":\"message\",\"args\":[{\"room\":\"general\",\"user\":\"alice\",\"text\":\"hey, is the deploy done?\",\"ts\":1381773302123}]}" },
+      { "price tick", "{\"name\":\"tick\",\"args\":[\"EURUSD\",1.35512,1.35518,1381773302123]}" },
+      { "presence update", "{\"name\":\"presence\",\"args\":[{\"user\":{\"id\":4412,\"name\":\"bob\",\"status\":\"away\",\"devices\":[\"ios\",\"web\"]},\"room\":\"ops\",\"since\":1381773302}]}" },
+      { "order book (50 levels)", order_book(50) },
+   };
+
+   // Twenty subscriptions, none of them to the payloads' names.
+   socketio::event_table<int> subscriptions;
+   for (int i = 0; i < 20; ++i) subscriptions.insert("subscribed_" + std::to_string(i), 1);
+
+   for (std::size_t p = 0; p < sizeof(payloads) / sizeof(payloads[0]); ++p)
+   {
+      std::cout << payloads[p].label << " (" << payloads[p].json.size() << " bytes)" << std::endl;
+
+      run("Parse<0>, fresh Document", payloads[p].json, iterations, [](const std::string& json) -> std::size_t {
+         Document d;
+         d.Parse<0>(json.c_str());
+         return d.HasParseError() ? 0 : d["args"].Size();
+      });
+
+      socketio::insitu_json_parser parser;
+      run("insitu_json_parser", payloads[p].json, iterations, [&parser](const std::string& json) -> std::size_t {
+         Document& d = parser.parse(json.data(), json.size());
+         return d.HasParseError() ? 0 : d["args"].Size();
+      });
+
+      socketio::event_stream_parser stream_parser;
+      summing_listener listener;
+      run("scan_event + event_stream_parser", payloads[p].json, iterations, [&stream_parser, &listener](const std::string& json) -> std::size_t {
+         socketio::event_scan scan;
+         if (!socketio::scan_event(json.data(), json.size(), scan) || !scan.args_begin) return 0;
+         listener.depth = 0;
+         return stream_parser.parse(scan.args_begin, scan.args_end, listener) ? listener.args : 0;
+      });
+
+      run("peek_event_name, unsubscribed", payloads[p].json, iterations, [&subscriptions](const std::string& json) -> std::size_t {
+         boost::string_ref name;
+         if (!socketio::peek_event_name(json.data(), json.size(), name)) return 0;
+         return subscriptions.find(name.data(), name.size()) ? 1 : 0;
+      });
+   }
+   return 0;
+}
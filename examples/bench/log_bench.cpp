@@ -0,0 +1,83 @@
+/* log_bench.cpp
+* Per-packet logging cost: the previous path (a std::stringstream built and the
+* message copied for every packet, whether or not the channel was on) against
+* SOCKETIO_LOG disabled at run time, sampled, and enabled with the ring drained
+* by the background thread. Levels below SOCKETIO_LOG_LEVEL compile to nothing.
+*
+* Usage: log_bench [packets]
+*/
+
+// Compile trace in so the run-time checks can be measured too.
+#define SOCKETIO_LOG_LEVEL 0
+#include <socket_io_log.hpp>
+
+#include <boost/utility/string_ref.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+   typedef std::chrono::steady_clock clock_type;
+
+   volatile std::size_t g_sink_bytes = 0;
+
+   void report(const char* label, clock_type::time_point start, int packets)
+   {
+      double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count()) / packets;
+      std::cout << label << ": " << ns << " ns/packet" << std::endl;
+   }
+
+}
+
+int main(int argc, char* argv[])
+{
+   int packets = argc > 1 ? std::atoi(argv[1]) : 1000000;
+   std::string packet("5:1+::{\"name\":\"update\",\"args\":[{\"id\":42,\"value\":3.5,\"tags\":[\"a\",\"b\"]}]}");
+   boost::string_ref msg(packet);
+
+   socketio::async_logger& logger = socketio::async_logger::instance();
+   logger.set_sink([](socketio::log_level, socketio::log_channel, const char*, std::size_t length) { g_sink_bytes += length; });
+
+   clock_type::time_point start = clock_type::now();
+   for (int i = 0; i < packets; ++i)
+   {
+      std::stringstream ss;
+      ss << "Received Message type 5 (Event): " << msg.to_string() << std::endl;
+      g_sink_bytes += ss.tellp() > 0 ? 0 : 1;
+   }
+   report("stringstream (channel off)", start, packets);
+
+   logger.set_level(socketio::log_info);
+   start = clock_type::now();
+   for (int i = 0; i < packets; ++i)
+   {
+      SOCKETIO_LOG(socketio::log_trace, socketio::log_packet, "Received Message type 5 (Event): " << msg);
+   }
+   report("SOCKETIO_LOG disabled at run time", start, packets);
+
+   logger.set_level(socketio::log_trace);
+   logger.set_sampling(socketio::log_packet, 1000);
+   start = clock_type::now();
+   for (int i = 0; i < packets; ++i)
+   {
+      SOCKETIO_LOG(socketio::log_trace, socketio::log_packet, "Received Message type 5 (Event): " << msg);
+   }
+   report("SOCKETIO_LOG sampled 1/1000", start, packets);
+
+   logger.set_sampling(socketio::log_packet, 1);
+   std::size_t dropped = logger.dropped();
+   start = clock_type::now();
+   for (int i = 0; i < packets; ++i)
+   {
+      SOCKETIO_LOG(socketio::log_trace, socketio::log_packet, "Received Message type 5 (Event): " << msg);
+   }
+   report("SOCKETIO_LOG enabled", start, packets);
+   logger.flush();
+   std::cout << "  " << logger.dropped() - dropped << " records dropped (ring full)" << std::endl;
+
+   return 0;
+}
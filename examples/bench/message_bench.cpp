@@ -0,0 +1,261 @@
+/* message_bench.cpp
+* Per-message cost of the handler itself, without a network: received frames go
+* through process_frame() (parse_message and dispatch), and emit/message/
+* json_message go through the send queue and the io work run by poll() into an
+* outbound sink. Reports ns, heap allocations and heap bytes per operation for
+* every packet type and a range of payload shapes.
+*
+* Heap bytes stand in for bytes copied: every copy of a payload the handler
+* makes lands in a freshly allocated or grown string.
+*
+* A few correctness checks on the same hooks run first; the run stops if one fails.
+*
+* Usage: message_bench [iterations]
+*/
+
+#include <socket_io_client.hpp>
+
+#include "alloc_counter.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using socketio::socketio_client_handler;
+using namespace rapidjson;
+
+namespace {
+
+   typedef std::chrono::steady_clock clock_type;
+
+   // Receives everything and does nothing, like an application that only counts.
+   class null_listener : public socketio_client_handler::socketio_listener
+   {
+   public:
+      void on_socketio_message(const std::string&, const std::string&, std::string*) {}
+      void on_socketio_json(const std::string&, Document&, std::string*) {}
+      void on_socketio_event(const std::string&, const std::string&, const Value&, std::string*) {}
+      void on_socketio_error(const std::string&, const std::string&, const std::string&) {}
+   };
+
+   // Streams args and keeps only the numbers.
+   class summing_stream : public socketio::event_stream_listener
+   {
+   public:
+      summing_stream() : sum(0) {}
+      void Uint(unsigned i) { sum += i; }
+      void Double(double d) { sum += d; }
+
+      double sum;
+   };
+
+   struct quote { std::string sym; double bid; double ask; long long ts; };
+   SOCKETIO_STRUCT(quote, (sym)(bid)(ask)(ts))
+
+   void run(const char* label, int iterations, const std::function<void (int)>& op)
+   {
+      // Warm up caches and any per-handler buffers first.
+      for (int i = 0; i < iterations / 10 + 1; ++i) op(i);
+
+      std::size_t allocations = g_allocations;
+      std::size_t bytes = g_allocated_bytes;
+      clock_type::time_point start = clock_type::now();
+      for (int i = 0; i < iterations; ++i) op(i);
+      double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count()) / iterations;
+
+      char line[160];
+      std::snprintf(line, sizeof(line), "%-34s %10.1f ns/op %8.2f allocs/op %10.1f bytes/op", label, ns,
+         double(g_allocations - allocations) / iterations, double(g_allocated_bytes - bytes) / iterations);
+      std::cout << line << std::endl;
+   }
+
+   std::string event_frame(const std::string& name, const std::string& args)
+   {
+      return "5:::{\"name\":\"" + name + "\",\"args\":" + args + "}";
+   }
+
+   // [{"id":0,...},...]
+   std::string object_array(int count)
+   {
+      std::ostringstream out;
+      out << "[";
+      for (int i = 0; i < count; ++i)
+      {
+         out << (i ? "," : "") << "{\"id\":" << i << ",\"price\":" << i * 1.25 << ",\"side\":\"buy\",\"tags\":[\"a\",\"b\"]}";
+      }
+      out << "]";
+      return out.str();
+   }
+
+   bool check(bool ok, const char* what)
+   {
+      if (!ok) std::cerr << "check failed: " << what << std::endl;
+      return ok;
+   }
+
+   // Every packet of a multi-packet frame decodes, not only the last one.
+   bool check_framed_json()
+   {
+      socketio_client_handler handler;
+      handler.set_outbound_sink([](const std::string&) {});
+      int ticks = 0;
+      handler.on("tick", [&ticks](const std::string&, const Value& args, std::string*) { if (args.IsArray() && args.Size() == 1) ++ticks; });
+
+      std::string framed;
+      socketio::append_framed(framed, "4:::{\"a\":1}");
+      socketio::append_framed(framed, event_frame("tick", "[1]"));
+      socketio::append_framed(framed, event_frame("tick", "[2]"));
+      handler.process_frame(framed);
+      handler.poll();
+      return check(ticks == 2 && handler.metrics().value(socketio::counter_parse_errors) == 0, "framed packets without in-situ parsing");
+   }
+
+   // Held packets replay without connects (the reconnect rejoins endpoints itself) or acks
+   // for the session that was lost.
+   bool check_replay()
+   {
+      socketio_client_handler handler;
+      handler.connect_endpoint("/chat");
+      handler.process_frame("5:7+::{\"name\":\"nobody\",\"args\":[]}");
+      handler.emit("tick", socketio::args(1), "/chat");
+      handler.poll();
+
+      std::string sent;
+      handler.set_outbound_sink([&sent](const std::string& frame) { sent += frame; sent += '\n'; });
+      handler.message("after");
+      handler.poll();
+      return check(sent.find("1::/chat") == std::string::npos && sent.find("6:::7") == std::string::npos &&
+         sent.find("5::/chat:") != std::string::npos && sent.find("after") != std::string::npos, "replay after reconnect");
+   }
+
+   void bench_receive(int iterations, bool insitu)
+   {
+      socketio_client_handler handler;
+      null_listener listener;
+      handler.set_socketio_listener(&listener);
+      handler.set_insitu_parsing(insitu);
+      handler.on("tick", [](const std::string&, const Value&, std::string*) {});
+      summing_stream stream;
+      handler.on("quote", &stream);
+      double bids = 0;
+      handler.on<quote>("typed", [&bids](const std::string&, const quote& q, std::string*) { bids += q.bid; });
+      handler.set_outbound_sink([](const std::string&) {});
+
+      std::string prefix = insitu ? "recv insitu " : "recv ";
+      std::string small_string = "\"" + std::string(32, 'x') + "\"";
+      std::string large_string = "\"" + std::string(64 * 1024, 'x') + "\"";
+
+      // Disconnect (0) is left out: it closes the handler.
+      struct frame_case { const char* name; std::string frame; };
+      frame_case cases[] = {
+         { "connect (1)", "1::/chat" },
+         { "heartbeat (2)", "2::" },
+         { "message (3) 32B", "3:::" + std::string(32, 'x') },
+         { "message (3) 64KiB", "3:::" + std::string(64 * 1024, 'x') },
+         { "json (4) small", "4:::{\"a\":1,\"b\":\"two\"}" },
+         { "json (4) 100 objects", "4:::" + object_array(100) },
+         { "event (5) on() small", event_frame("tick", "[" + small_string + "]") },
+         { "event (5) stream 3 numbers", event_frame("quote", "[\"EURUSD\",1.35512,1.35518,1381773302]") },
+         { "event (5) on() 3 numbers", event_frame("tick", "[\"EURUSD\",1.35512,1.35518,1381773302]") },
+         { "event (5) on<T> object", event_frame("typed", "[{\"sym\":\"EURUSD\",\"bid\":1.35512,\"ask\":1.35518,\"ts\":1381773302}]") },
+         { "event (5) on() object", event_frame("tick", "[{\"sym\":\"EURUSD\",\"bid\":1.35512,\"ask\":1.35518,\"ts\":1381773302}]") },
+         { "event (5) listener small", event_frame("other", "[" + small_string + "]") },
+         { "event (5) 100 objects", event_frame("tick", "[" + object_array(100) + "]") },
+         { "event (5) 64KiB string", event_frame("tick", "[" + large_string + "]") },
+         { "ack (6) unknown id", "6:::12345" },
+         { "error (7)", "7:::unauthorized+reconnect" },
+         { "noop (8)", "8::" },
+      };
+      for (std::size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+      {
+         const std::string& frame = cases[c].frame;
+         // poll() writes any reply, e.g. the heartbeat answering a heartbeat.
+         run((prefix + cases[c].name).c_str(), iterations, [&handler, &frame](int) { handler.process_frame(frame); handler.poll(); });
+      }
+
+      // Ten small events in one multi-packet frame; ns/op is per frame.
+      std::string framed;
+      for (int i = 0; i < 10; ++i) socketio::append_framed(framed, event_frame("tick", "[" + small_string + "]"));
+      run((prefix + "framed 10 x event (5)").c_str(), iterations, [&handler, &framed](int) { handler.process_frame(framed); handler.poll(); });
+   }
+
+   // Events spread over 50 namespaces, each with its own handler.
+   void bench_namespaces(int iterations)
+   {
+      socketio_client_handler handler;
+      handler.set_outbound_sink([](const std::string&) {});
+      std::vector<std::string> frames;
+      unsigned long received = 0;
+      for (int i = 0; i < 50; ++i)
+      {
+         std::string endpoint = "/room" + std::to_string(i);
+         handler.of(endpoint).on("tick", [&received](const std::string&, const Value&, std::string*) { ++received; });
+         frames.push_back("5::" + endpoint + ":{\"name\":\"tick\",\"args\":[1]}");
+      }
+      run("recv event (5) 50 namespaces", iterations, [&](int i) { handler.process_frame(frames[i % frames.size()]); handler.poll(); });
+
+      socketio::socketio_namespace& room = handler.of("/room7");
+      run("emit args on namespace", iterations, [&](int) { room.emit("tick", socketio::args(42)); handler.poll(); });
+   }
+
+   void bench_send(int iterations)
+   {
+      socketio_client_handler handler;
+      std::size_t sent_bytes = 0;
+      handler.set_outbound_sink([&sent_bytes](const std::string& frame) { sent_bytes += frame.size(); });
+
+      Document small;
+      small.SetObject();
+      Value args(kArrayType);
+      args.PushBack(42, small.GetAllocator());
+      args.PushBack("thirty-two bytes of payload text", small.GetAllocator());
+      small.AddMember("args", args, small.GetAllocator());
+
+      Document large;
+      std::string large_json = "{\"args\":[" + object_array(100) + "]}";
+      large.Parse<0>(large_json.c_str());
+
+      std::string text32(32, 'x');
+      std::string text64k(64 * 1024, 'x');
+
+      run("emit Document small", iterations, [&](int) { handler.emit("tick", small); handler.poll(); });
+      run("emit Document 100 objects", iterations, [&](int) { handler.emit("tick", large); handler.poll(); });
+      run("emit args (42, 32B)", iterations, [&](int) { handler.emit("tick", socketio::args(42, text32)); handler.poll(); });
+      run("emit string 32B", iterations, [&](int) { handler.emit("tick", text32); handler.poll(); });
+      run("emit string 64KiB", iterations, [&](int) { handler.emit("tick", text64k); handler.poll(); });
+      run("message 32B", iterations, [&](int) { handler.message(text32); handler.poll(); });
+      run("json_message small", iterations, [&](int) { handler.json_message(small); handler.poll(); });
+
+      // The server's ack comes straight back, so the registry never fills up.
+      unsigned int next_id = 1;
+      run("emit + ack round trip", iterations, [&](int) {
+         handler.emit("tick", small, "", []() {});
+         handler.poll();
+         handler.process_frame("6:::" + std::to_string(next_id++));
+      });
+
+      run("emit x 10, one poll", iterations, [&](int) {
+         for (int i = 0; i < 10; ++i) handler.emit("tick", small);
+         handler.poll();
+      });
+   }
+
+}
+
+int main(int argc, char* argv[])
+{
+   int iterations = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+   if (!check_framed_json() || !check_replay()) return 1;
+
+   bench_receive(iterations, false);
+   bench_receive(iterations, true);
+   bench_namespaces(iterations);
+   bench_send(iterations);
+   return 0;
+}
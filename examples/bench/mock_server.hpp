@@ -0,0 +1,460 @@
+/* mock_server.hpp
+* Loopback socket.IO 0.9 server for benchmarks, in plain asio.
+*
+* Speaks just enough of the protocol to exercise the client end to end without
+* Node: the POST /socket.io/1/ handshake (keep-alive or not), the websocket
+* upgrade on /socket.io/1/websocket/<sid>, RFC 6455 framing and the 0.9 packet
+* format. Every packet that asks for an ack is acked at once. An event called
+* "flood" with the argument "count:size" makes the server push count "data"
+* events carrying size bytes each, for measuring receive throughput. Sessions are
+* spread over one io_service thread each, so a session never needs a strand.
+*/
+
+#ifndef __SOCKET_IO_MOCK_SERVER_HPP__
+#define __SOCKET_IO_MOCK_SERVER_HPP__
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/uuid/detail/sha1.hpp>
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace socketio_bench {
+
+   using boost::asio::ip::tcp;
+
+   class mock_server {
+   public:
+      // Listens on 127.0.0.1:port (0 picks a free port) with one io_service per thread.
+      explicit mock_server(unsigned short port = 0, std::size_t threads = 1, unsigned int heartbeat_seconds = 25) :
+         m_acceptor(m_accept_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), port)),
+         m_heartbeat(heartbeat_seconds),
+         m_next_service(0),
+         m_next_sid(1),
+         m_sessions(0),
+         m_packets_received(0),
+         m_bytes_received(0),
+         m_packets_sent(0)
+      {
+         if (threads == 0) threads = 1;
+         for (std::size_t i = 0; i < threads; ++i)
+         {
+            m_services.push_back(std::unique_ptr<boost::asio::io_service>(new boost::asio::io_service));
+            m_work.push_back(std::unique_ptr<boost::asio::io_service::work>(new boost::asio::io_service::work(*m_services.back())));
+         }
+         for (std::size_t i = 0; i < threads; ++i)
+         {
+            boost::asio::io_service* service = m_services[i].get();
+            m_threads.push_back(std::thread([service]() { service->run(); }));
+         }
+         accept();
+         m_accept_thread = std::thread([this]() { m_accept_service.run(); });
+      }
+
+      ~mock_server()
+      {
+         stop();
+      }
+
+      unsigned short port() const { return m_acceptor.local_endpoint().port(); }
+
+      void stop()
+      {
+         if (!m_accept_thread.joinable()) return;
+         m_accept_service.stop();
+         m_accept_thread.join();
+         // The pending accept holds a session whose socket and timer belong to a session
+         // io_service; let it complete as aborted while those still exist.
+         boost::system::error_code ignored;
+         m_acceptor.close(ignored);
+         m_accept_service.reset();
+         m_accept_service.poll();
+         m_work.clear();
+         for (std::size_t i = 0; i < m_services.size(); ++i) m_services[i]->stop();
+         for (std::size_t i = 0; i < m_threads.size(); ++i) m_threads[i].join();
+      }
+
+      // Websocket sessions opened so far.
+      std::size_t sessions() const { return m_sessions; }
+
+      // Socket.IO packets received and sent over websockets, and websocket payload bytes received.
+      unsigned long long packets_received() const { return m_packets_received; }
+      unsigned long long bytes_received() const { return m_bytes_received; }
+      unsigned long long packets_sent() const { return m_packets_sent; }
+
+   private:
+      class session : public std::enable_shared_from_this<session>
+      {
+      public:
+         session(mock_server& server, boost::asio::io_service& io_service) :
+            m_server(server), m_socket(io_service), m_heartbeat_timer(io_service), m_websocket(false),
+            m_offset(0), m_writing(false), m_closing(false)
+         {}
+
+         tcp::socket& socket() { return m_socket; }
+
+         void start()
+         {
+            read();
+         }
+
+      private:
+         void read()
+         {
+            std::shared_ptr<session> self = shared_from_this();
+            m_socket.async_read_some(boost::asio::buffer(m_chunk), [self](const boost::system::error_code& ec, std::size_t bytes) {
+               if (ec)
+               {
+                  self->shutdown();
+                  return;
+               }
+               self->m_input.append(self->m_chunk, bytes);
+               if (!self->process()) return;
+               self->read();
+            });
+         }
+
+         // Handles everything complete in m_input. Returns false once the session is closing.
+         bool process()
+         {
+            for (;;)
+            {
+               if (m_closing) return false;
+               bool progress = m_websocket ? read_frame() : read_request();
+               if (!progress) break;
+            }
+            // Drop what has been consumed, but don't shuffle a large frame for every chunk.
+            if (m_offset > 0 && (m_offset == m_input.size() || m_offset > 65536))
+            {
+               m_input.erase(0, m_offset);
+               m_offset = 0;
+            }
+            return !m_closing;
+         }
+
+         bool read_request()
+         {
+            std::size_t end = m_input.find("\r\n\r\n", m_offset);
+            if (end == std::string::npos) return false;
+            std::string request = m_input.substr(m_offset, end - m_offset);
+            m_offset = end + 4;
+
+            std::istringstream lines(request);
+            std::string method, path, version, line;
+            lines >> method >> path >> version;
+            std::getline(lines, line);
+            std::string key, connection;
+            while (std::getline(lines, line))
+            {
+               if (!line.empty() && line[line.size() - 1] == '\r') line.resize(line.size() - 1);
+               std::size_t colon = line.find(':');
+               if (colon == std::string::npos) continue;
+               std::string name = lower(line.substr(0, colon));
+               std::size_t start = line.find_first_not_of(' ', colon + 1);
+               std::string value = start == std::string::npos ? std::string() : line.substr(start);
+               if (name == "sec-websocket-key") key = value;
+               else if (name == "connection") connection = lower(value);
+            }
+
+            if (method == "POST" && path.compare(0, 13, "/socket.io/1/") == 0 && path.size() == 13)
+            {
+               // sid:heartbeat timeout:close timeout:transports
+               std::ostringstream body;
+               body << m_server.m_next_sid++ << ":" << m_server.m_heartbeat * 2 << ":" << m_server.m_heartbeat * 3 << ":websocket";
+               bool keep_alive = version == "HTTP/1.1" ? connection.find("close") == std::string::npos : connection.find("keep-alive") != std::string::npos;
+               std::ostringstream response;
+               response << version << " 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " << body.str().size()
+                  << (keep_alive ? "\r\nConnection: keep-alive" : "\r\nConnection: close") << "\r\n\r\n" << body.str();
+               write(response.str(), !keep_alive);
+               return !m_closing;
+            }
+            if (method == "GET" && path.compare(0, 23, "/socket.io/1/websocket/") == 0 && !key.empty())
+            {
+               std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
+               response += accept_key(key);
+               response += "\r\n\r\n";
+               write(response, false);
+               m_websocket = true;
+               ++m_server.m_sessions;
+               send_packet("1::");
+               schedule_heartbeat();
+               return true;
+            }
+            write(version + " 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", true);
+            return false;
+         }
+
+         bool read_frame()
+         {
+            std::size_t available = m_input.size() - m_offset;
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(m_input.data() + m_offset);
+            if (available < 2) return false;
+            bool fin = (p[0] & 0x80) != 0;
+            int opcode = p[0] & 0x0f;
+            bool masked = (p[1] & 0x80) != 0;
+            unsigned long long length = p[1] & 0x7f;
+            std::size_t header = 2;
+            if (length == 126)
+            {
+               if (available < 4) return false;
+               length = (unsigned long long)(p[2]) << 8 | p[3];
+               header = 4;
+            }
+            else if (length == 127)
+            {
+               if (available < 10) return false;
+               length = 0;
+               for (int i = 0; i < 8; ++i) length = length << 8 | p[2 + i];
+               header = 10;
+            }
+            const unsigned char* mask = p + header;
+            if (masked) header += 4;
+            if (available < header + length) return false;
+
+            std::size_t begin = m_message.size();
+            m_message.append(reinterpret_cast<const char*>(p + header), std::size_t(length));
+            if (masked)
+            {
+               for (std::size_t i = 0; i < length; ++i) m_message[begin + i] ^= char(mask[i & 3]);
+            }
+            m_offset += header + std::size_t(length);
+
+            if (opcode == 0x8)
+            {
+               send_frame(0x8, std::string(), true);
+               return false;
+            }
+            if (opcode == 0x9)
+            {
+               send_frame(0xA, m_message.substr(begin), false);
+               m_message.resize(begin);
+               return true;
+            }
+            if (opcode == 0xA)
+            {
+               m_message.resize(begin);
+               return true;
+            }
+            if (fin)
+            {
+               on_packet(m_message);
+               m_message.clear();
+            }
+            return true;
+         }
+
+         // type:id[+]:endpoint[:data]
+         void on_packet(const std::string& packet)
+         {
+            ++m_server.m_packets_received;
+            m_server.m_bytes_received += packet.size();
+            std::size_t first = packet.find(':');
+            if (first == std::string::npos) return;
+            std::size_t second = packet.find(':', first + 1);
+            if (second == std::string::npos) return;
+            std::size_t third = packet.find(':', second + 1);
+            char type = packet[0];
+            std::string id = packet.substr(first + 1, second - first - 1);
+            std::string endpoint = packet.substr(second + 1, third == std::string::npos ? std::string::npos : third - second - 1);
+
+            if (type == '0')
+            {
+               send_frame(0x8, std::string(), true);
+               return;
+            }
+            if (type == '1')
+            {
+               send_packet("1::" + endpoint);
+               return;
+            }
+            if (!id.empty())
+            {
+               bool with_data = id[id.size() - 1] == '+';
+               if (with_data) id.resize(id.size() - 1);
+               send_packet("6:::" + id + (with_data ? "+[]" : ""));
+            }
+            if (type == '5' && third != std::string::npos && packet.compare(third + 1, 16, "{\"name\":\"flood\",") == 0)
+            {
+               // {"name":"flood","args":["count:size"]}
+               std::size_t arg = packet.find("[\"", third);
+               if (arg == std::string::npos) return;
+               char* rest = NULL;
+               unsigned long count = std::strtoul(packet.c_str() + arg + 2, &rest, 10);
+               unsigned long size = *rest == ':' ? std::strtoul(rest + 1, NULL, 10) : 0;
+               flood(endpoint, count, size);
+            }
+         }
+
+         void flood(const std::string& endpoint, unsigned long count, unsigned long size)
+         {
+            std::string packet = "5::" + endpoint + ":{\"name\":\"data\",\"args\":[\"";
+            packet.append(size, 'x');
+            packet += "\"]}";
+            for (unsigned long i = 0; i < count; ++i) send_packet(packet);
+         }
+
+         void schedule_heartbeat()
+         {
+            std::shared_ptr<session> self = shared_from_this();
+            m_heartbeat_timer.expires_from_now(std::chrono::seconds(m_server.m_heartbeat));
+            m_heartbeat_timer.async_wait([self](const boost::system::error_code& ec) {
+               if (ec || self->m_closing) return;
+               self->send_packet("2::");
+               self->schedule_heartbeat();
+            });
+         }
+
+         void send_packet(const std::string& packet)
+         {
+            ++m_server.m_packets_sent;
+            send_frame(0x1, packet, false);
+         }
+
+         void send_frame(int opcode, const std::string& payload, bool close)
+         {
+            std::string frame;
+            frame.reserve(payload.size() + 10);
+            frame += char(0x80 | opcode);
+            if (payload.size() < 126) frame += char(payload.size());
+            else if (payload.size() <= 0xffff)
+            {
+               frame += char(126);
+               frame += char(payload.size() >> 8);
+               frame += char(payload.size() & 0xff);
+            }
+            else
+            {
+               frame += char(127);
+               for (int i = 7; i >= 0; --i) frame += char((unsigned long long)(payload.size()) >> (8 * i) & 0xff);
+            }
+            frame += payload;
+            write(frame, close);
+         }
+
+         // Queues data; with close the connection is shut down once it has been written.
+         void write(const std::string& data, bool close)
+         {
+            if (m_closing) return;
+            m_outbound.push_back(data);
+            if (close) m_closing = true;
+            if (!m_writing) write_next();
+         }
+
+         void write_next()
+         {
+            if (m_outbound.empty())
+            {
+               m_writing = false;
+               if (m_closing) shutdown();
+               return;
+            }
+            m_writing = true;
+            std::shared_ptr<session> self = shared_from_this();
+            boost::asio::async_write(m_socket, boost::asio::buffer(m_outbound.front()), [self](const boost::system::error_code& ec, std::size_t) {
+               self->m_outbound.pop_front();
+               if (ec)
+               {
+                  self->m_outbound.clear();
+                  self->m_closing = true;
+               }
+               self->write_next();
+            });
+         }
+
+         void shutdown()
+         {
+            m_closing = true;
+            boost::system::error_code ignored;
+            m_heartbeat_timer.cancel(ignored);
+            m_socket.shutdown(tcp::socket::shutdown_both, ignored);
+            m_socket.close(ignored);
+         }
+
+         static std::string lower(std::string s)
+         {
+            for (std::size_t i = 0; i < s.size(); ++i) s[i] = char(std::tolower((unsigned char)s[i]));
+            return s;
+         }
+
+         // base64(sha1(key + GUID)), RFC 6455 section 4.2.2.
+         static std::string accept_key(const std::string& key)
+         {
+            boost::uuids::detail::sha1 sha;
+            std::string input = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+            sha.process_bytes(input.data(), input.size());
+            unsigned int digest[5];
+            sha.get_digest(digest);
+            unsigned char bytes[20];
+            for (int i = 0; i < 5; ++i)
+            {
+               for (int j = 0; j < 4; ++j) bytes[i * 4 + j] = (unsigned char)(digest[i] >> (24 - 8 * j));
+            }
+            static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            std::string out;
+            for (int i = 0; i < 20; i += 3)
+            {
+               unsigned int n = bytes[i] << 16 | (i + 1 < 20 ? bytes[i + 1] << 8 : 0) | (i + 2 < 20 ? bytes[i + 2] : 0);
+               out += alphabet[n >> 18 & 63];
+               out += alphabet[n >> 12 & 63];
+               out += i + 1 < 20 ? alphabet[n >> 6 & 63] : '=';
+               out += i + 2 < 20 ? alphabet[n & 63] : '=';
+            }
+            return out;
+         }
+
+         mock_server& m_server;
+         tcp::socket m_socket;
+         boost::asio::steady_timer m_heartbeat_timer;
+         bool m_websocket;
+         char m_chunk[65536];
+         std::string m_input;
+         std::size_t m_offset;
+         // Fragments of the websocket message being received.
+         std::string m_message;
+         std::deque<std::string> m_outbound;
+         bool m_writing;
+         bool m_closing;
+      };
+
+      void accept()
+      {
+         boost::asio::io_service& service = *m_services[m_next_service++ % m_services.size()];
+         std::shared_ptr<session> s(new session(*this, service));
+         m_acceptor.async_accept(s->socket(), [this, s, &service](const boost::system::error_code& ec) {
+            if (ec) return;
+            boost::system::error_code ignored;
+            s->socket().set_option(tcp::no_delay(true), ignored);
+            // Run the session on its own io_service thread from here on.
+            service.post([s]() { s->start(); });
+            accept();
+         });
+      }
+
+      boost::asio::io_service m_accept_service;
+      tcp::acceptor m_acceptor;
+      unsigned int m_heartbeat;
+      std::vector<std::unique_ptr<boost::asio::io_service> > m_services;
+      std::vector<std::unique_ptr<boost::asio::io_service::work> > m_work;
+      std::vector<std::thread> m_threads;
+      std::thread m_accept_thread;
+      std::size_t m_next_service;
+      std::atomic<unsigned long> m_next_sid;
+      std::atomic<std::size_t> m_sessions;
+      std::atomic<unsigned long long> m_packets_received;
+      std::atomic<unsigned long long> m_bytes_received;
+      std::atomic<unsigned long long> m_packets_sent;
+   };
+
+}
+
+#endif // __SOCKET_IO_MOCK_SERVER_HPP__
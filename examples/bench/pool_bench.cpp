@@ -0,0 +1,120 @@
+/* pool_bench.cpp
+* Compares thread count and context switches per 1k sessions for standalone
+* handlers (one network thread each) and handlers attached to a socketio_client_pool.
+*
+* Usage: pool_bench <ws uri> [sessions] [pool|standalone] [pool threads] [seconds]
+* Start a server first, e.g. `node examples/test.js`.
+*/
+
+#include <socket_io_client.hpp>
+#include <socket_io_client_pool.hpp>
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using socketio::socketio_client_handler;
+
+namespace {
+
+   class counting_listener : public socketio_client_handler::connection_listener
+   {
+   public:
+      counting_listener() : opened(0), failed(0) {}
+      void on_fail(websocketpp::connection_hdl) { ++failed; }
+      void on_open(websocketpp::connection_hdl) { ++opened; }
+      void on_close(websocketpp::connection_hdl) {}
+
+      std::atomic<int> opened;
+      std::atomic<int> failed;
+   };
+
+   // Reads the "Threads:" line of /proc/self/status.
+   int thread_count()
+   {
+      std::ifstream status("/proc/self/status");
+      std::string key;
+      while (status >> key)
+      {
+         if (key == "Threads:")
+         {
+            int n = 0;
+            status >> n;
+            return n;
+         }
+      }
+      return -1;
+   }
+
+   long context_switches()
+   {
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      return usage.ru_nvcsw + usage.ru_nivcsw;
+   }
+
+}
+
+int main(int argc, char* argv[])
+{
+   if (argc < 2)
+   {
+      std::cerr << "Usage: " << argv[0] << " <ws uri> [sessions] [pool|standalone] [pool threads] [seconds]" << std::endl;
+      return 1;
+   }
+   std::string uri = argv[1];
+   int sessions = argc > 2 ? std::atoi(argv[2]) : 1000;
+   bool pooled = argc > 3 ? std::string(argv[3]) != "standalone" : true;
+   std::size_t pool_threads = argc > 4 ? std::atoi(argv[4]) : 0;
+   int seconds = argc > 5 ? std::atoi(argv[5]) : 10;
+
+   std::unique_ptr<socketio::socketio_client_pool> pool;
+   if (pooled) pool.reset(new socketio::socketio_client_pool(pool_threads));
+
+   counting_listener listener;
+   std::vector<std::unique_ptr<socketio_client_handler> > handlers;
+   handlers.reserve(sessions);
+
+   int threads_before = thread_count();
+   for (int i = 0; i < sessions; ++i)
+   {
+      std::unique_ptr<socketio_client_handler> h(pooled ? new socketio_client_handler(*pool) : new socketio_client_handler());
+      h->set_connection_listener(&listener);
+      h->connect(uri);
+      handlers.push_back(std::move(h));
+   }
+
+   // Wait for every session to settle before measuring steady state.
+   auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+   while (listener.opened + listener.failed < sessions && std::chrono::steady_clock::now() < deadline)
+   {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+   }
+
+   long switches_before = context_switches();
+   std::this_thread::sleep_for(std::chrono::seconds(seconds));
+   long switches = context_switches() - switches_before;
+   int threads = thread_count() - threads_before;
+
+   double per_k = 1000.0 / sessions;
+   std::cout << (pooled ? "pool" : "standalone") << " sessions=" << sessions
+             << " opened=" << listener.opened << " failed=" << listener.failed << std::endl;
+   std::cout << "threads: " << threads << " (" << threads * per_k << " per 1k sessions)" << std::endl;
+   std::cout << "context switches over " << seconds << "s: " << switches
+             << " (" << switches * per_k / seconds << " per second per 1k sessions)" << std::endl;
+
+   for (std::size_t i = 0; i < handlers.size(); ++i)
+   {
+      handlers[i]->close();
+   }
+   handlers.clear();
+   if (pool) pool->stop();
+   return 0;
+}
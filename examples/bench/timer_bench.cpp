@@ -0,0 +1,111 @@
+/* timer_bench.cpp
+* Cost of keeping one timer per session with a boost::asio::deadline_timer per
+* session (the previous heartbeat and ack timers) and with one timing_wheel per
+* io_service thread. Measures arming, re-arming (a heartbeat or disconnect check
+* being pushed out), the time from the deadline until every timer has fired and
+* heap allocations per timer.
+*
+* Usage: timer_bench [sessions]
+*/
+
+#include <socket_io_timer_wheel.hpp>
+
+#include "alloc_counter.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+
+   typedef std::chrono::steady_clock clock_type;
+
+   double ns_per(clock_type::time_point start, int count)
+   {
+      return double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count()) / count;
+   }
+
+   void report(const char* label, const char* phase, double ns, std::size_t allocations, int sessions)
+   {
+      std::cout << label << " " << phase << ": " << ns << " ns/timer, "
+         << double(allocations) / sessions << " allocs/timer" << std::endl;
+   }
+
+   void bench_deadline_timer(int sessions)
+   {
+      boost::asio::io_service io_service;
+      std::vector<std::unique_ptr<boost::asio::deadline_timer> > timers;
+      timers.reserve(sessions);
+      int fired = 0;
+
+      std::size_t allocations = g_allocations;
+      clock_type::time_point start = clock_type::now();
+      for (int i = 0; i < sessions; ++i)
+      {
+         timers.push_back(std::unique_ptr<boost::asio::deadline_timer>(new boost::asio::deadline_timer(io_service, boost::posix_time::seconds(25))));
+         timers.back()->async_wait([&fired](const boost::system::error_code& ec) { if (!ec) ++fired; });
+      }
+      report("deadline_timer", "arm", ns_per(start, sessions), g_allocations - allocations, sessions);
+
+      // Re-arming cancels the pending wait, whose aborted handler then has to run.
+      allocations = g_allocations;
+      start = clock_type::now();
+      for (int i = 0; i < sessions; ++i)
+      {
+         timers[i]->expires_from_now(boost::posix_time::milliseconds(200));
+         timers[i]->async_wait([&fired](const boost::system::error_code& ec) { if (!ec) ++fired; });
+      }
+      clock_type::time_point due = clock_type::now() + std::chrono::milliseconds(200);
+      io_service.poll();
+      report("deadline_timer", "re-arm", ns_per(start, sessions), g_allocations - allocations, sessions);
+
+      io_service.run();
+      std::cout << "deadline_timer fire: " << fired << " fired, " << ns_per(due, sessions) << " ns/timer past the deadline" << std::endl;
+   }
+
+   void bench_wheel(int sessions)
+   {
+      boost::asio::io_service io_service;
+      socketio::timing_wheel wheel(io_service);
+      std::vector<socketio::timing_wheel::timer_id> timers(sessions);
+      int fired = 0;
+
+      std::size_t allocations = g_allocations;
+      clock_type::time_point start = clock_type::now();
+      for (int i = 0; i < sessions; ++i)
+      {
+         timers[i] = wheel.schedule(std::chrono::seconds(25), [&fired]() { ++fired; });
+      }
+      report("timing_wheel", "arm", ns_per(start, sessions), g_allocations - allocations, sessions);
+
+      allocations = g_allocations;
+      start = clock_type::now();
+      for (int i = 0; i < sessions; ++i)
+      {
+         wheel.cancel(timers[i]);
+         timers[i] = wheel.schedule(std::chrono::milliseconds(200), [&fired]() { ++fired; });
+      }
+      clock_type::time_point due = clock_type::now() + std::chrono::milliseconds(200);
+      io_service.poll();
+      report("timing_wheel", "re-arm", ns_per(start, sessions), g_allocations - allocations, sessions);
+
+      io_service.run();
+      std::cout << "timing_wheel fire: " << fired << " fired, " << ns_per(due, sessions) << " ns/timer past the deadline" << std::endl;
+   }
+
+}
+
+int main(int argc, char* argv[])
+{
+   int sessions = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+   bench_deadline_timer(sessions);
+   bench_wheel(sessions);
+
+   return 0;
+}
@@ -0,0 +1,249 @@
+/* socket_io_ack.hpp
+* Per-connection registry of packets waiting for a server ack.
+*
+* Ack ids are handed out sequentially per connection and map onto a power-of-two
+* slot array (slot = id & mask). Each slot remembers the id it was issued for, so
+* a late or duplicate ack for a recycled slot is recognised and ignored. Insert and
+* complete are O(1). When a new id's slot is still taken the array doubles, up to
+* a maximum capacity; only past that is the older ack evicted. Deadlines are kept by the caller (the handler puts them on its
+* timing wheel) and come back through timeout(); the slot only remembers the
+* wheel timer so completing an ack can cancel it. Each slot also keeps the time
+* the ack was registered and the histogram its round trip is recorded into.
+*/
+
+#ifndef __SOCKET_IO_ACK_HPP__
+#define __SOCKET_IO_ACK_HPP__
+
+#include <boost/cstdint.hpp>
+
+#include "socket_io_histogram.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace socketio {
+
+   class ack_registry {
+   public:
+      typedef std::function<void (void)> callback;
+      typedef boost::uint64_t timer_id;
+      typedef std::chrono::steady_clock clock;
+
+      // Where and how long: filled in by complete() for acks registered with a histogram.
+      struct round_trip
+      {
+         round_trip() : histogram(NULL)
+         {}
+
+         latency_histogram* histogram;
+         clock::duration elapsed;
+      };
+
+      // Both capacities are rounded up to a power of two.
+      explicit ack_registry(std::size_t capacity = 1024, std::size_t max_capacity = 65536) : m_next_id(1), m_pending(0)
+      {
+         m_slots.resize(round_up(capacity));
+         m_max_capacity = round_up(max_capacity);
+      }
+
+      // How far the slot array may grow. It never shrinks below its current size.
+      void set_max_capacity(std::size_t max_capacity)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_max_capacity = round_up(max_capacity);
+      }
+
+      // Registers ack under a fresh id and returns it. on_timeout (may be empty) runs instead
+      // of ack if the ack times out or the registry is cancelled first. When the slot for the
+      // new id is still taken the array grows; at the maximum capacity the ack in the slot is
+      // evicted instead, its on_timeout runs and evicted (if given) is set.
+      // histogram (may be NULL) is handed back by complete() with the round-trip time.
+      unsigned int add(const callback& ack, const callback& on_timeout, latency_histogram* histogram = NULL, bool* evicted = NULL)
+      {
+         clock::time_point sent = clock::now();
+         callback evicted_timeout;
+         unsigned int id;
+         {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            id = m_next_id++;
+            if (m_next_id == 0) m_next_id = 1;
+
+            while (m_slots[id & (m_slots.size() - 1)].id != 0 && m_slots.size() < m_max_capacity) grow();
+            slot& s = m_slots[id & (m_slots.size() - 1)];
+            if (s.id != 0)
+            {
+               evicted_timeout.swap(s.on_timeout);
+               --m_pending;
+               if (evicted) *evicted = true;
+            }
+            s.id = id;
+            s.timer = 0;
+            s.ack = ack;
+            s.on_timeout = on_timeout;
+            s.histogram = histogram;
+            s.sent = sent;
+            ++m_pending;
+         }
+         if (evicted_timeout) evicted_timeout();
+         return id;
+      }
+
+      // Remembers the deadline timer scheduled for id. Returns false if the ack already
+      // completed, in which case the caller should cancel the timer.
+      bool set_timer(unsigned int id, timer_id timer)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         slot& s = m_slots[id & (m_slots.size() - 1)];
+         if (id == 0 || s.id != id) return false;
+         s.timer = timer;
+         return true;
+      }
+
+      // Runs and removes the ack registered under id, storing its deadline timer (0 if none)
+      // in timer and the time since add() in rtt. Returns false for unknown, timed out or
+      // already completed ids.
+      bool complete(unsigned int id, timer_id* timer = NULL, round_trip* rtt = NULL)
+      {
+         clock::time_point now = clock::now();
+         callback ack;
+         {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot& s = m_slots[id & (m_slots.size() - 1)];
+            if (id == 0 || s.id != id) return false;
+            if (timer) *timer = s.timer;
+            if (rtt)
+            {
+               rtt->histogram = s.histogram;
+               rtt->elapsed = now - s.sent;
+            }
+            ack.swap(s.ack);
+            s.clear();
+            --m_pending;
+         }
+         if (ack) ack();
+         return true;
+      }
+
+      // Gives up on the ack registered under id and runs its timeout callback. Returns false
+      // if it completed (or was cancelled) first.
+      bool timeout(unsigned int id)
+      {
+         callback on_timeout;
+         {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot& s = m_slots[id & (m_slots.size() - 1)];
+            if (id == 0 || s.id != id) return false;
+            on_timeout.swap(s.on_timeout);
+            s.clear();
+            --m_pending;
+         }
+         if (on_timeout) on_timeout();
+         return true;
+      }
+
+      // Drops every pending ack at once, running their timeout callbacks. The deadline timers
+      // of the dropped acks are appended to timers if given. Ids in keep (sorted, may be
+      // NULL) stay pending. Returns how many were dropped.
+      std::size_t cancel_all(std::vector<timer_id>* timers = NULL, const std::vector<unsigned int>* keep = NULL)
+      {
+         std::vector<callback> cancelled;
+         {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < m_slots.size() && m_pending > kept; ++i)
+            {
+               if (m_slots[i].id == 0) continue;
+               if (keep && std::binary_search(keep->begin(), keep->end(), m_slots[i].id))
+               {
+                  ++kept;
+                  continue;
+               }
+               if (timers && m_slots[i].timer) timers->push_back(m_slots[i].timer);
+               cancelled.push_back(callback());
+               cancelled.back().swap(m_slots[i].on_timeout);
+               m_slots[i].clear();
+               --m_pending;
+            }
+         }
+         for (std::size_t i = 0; i < cancelled.size(); ++i)
+         {
+            if (cancelled[i]) cancelled[i]();
+         }
+         return cancelled.size();
+      }
+
+      // Acks still waiting for the server.
+      std::size_t pending() const
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         return m_pending;
+      }
+
+      // Current size of the slot array.
+      std::size_t capacity() const
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         return m_slots.size();
+      }
+
+   private:
+      ack_registry(const ack_registry&);
+      ack_registry& operator=(const ack_registry&);
+
+      struct slot
+      {
+         slot() : id(0), timer(0), histogram(NULL)
+         {}
+
+         void clear()
+         {
+            id = 0;
+            timer = 0;
+            histogram = NULL;
+            ack = callback();
+            on_timeout = callback();
+         }
+
+         unsigned int id;        // 0 when free
+         timer_id timer;         // deadline timer on the handler's wheel, 0 if none
+         callback ack;
+         callback on_timeout;
+         latency_histogram* histogram;
+         clock::time_point sent;
+      };
+
+      static std::size_t round_up(std::size_t capacity)
+      {
+         std::size_t size = 1;
+         while (size < capacity) size *= 2;
+         return size;
+      }
+
+      // Doubles the slot array. Ids that had distinct slots keep distinct slots, since the
+      // new mask only adds a bit. Called with m_mutex held.
+      void grow()
+      {
+         std::vector<slot> slots(m_slots.size() * 2);
+         for (std::size_t i = 0; i < m_slots.size(); ++i)
+         {
+            if (m_slots[i].id == 0) continue;
+            slot& s = slots[m_slots[i].id & (slots.size() - 1)];
+            s = std::move(m_slots[i]);
+         }
+         m_slots.swap(slots);
+      }
+
+      mutable std::mutex m_mutex;
+      std::vector<slot> m_slots;
+      std::size_t m_max_capacity;
+      unsigned int m_next_id;
+      std::size_t m_pending;
+   };
+
+}
+
+#endif // __SOCKET_IO_ACK_HPP__
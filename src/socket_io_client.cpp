@@ -8,186 +8,342 @@
 */
 
 #include "socket_io_client.hpp"
+#include <algorithm>
 #include <sstream>
 #include <boost/tokenizer.hpp>
-// Comment this out to disable handshake logging to stdout
-#define LOG(x) std::cout << x
-//#define LOG(x)
 
 using socketio::socketio_client_handler;
+using socketio::socketio_namespace;
 
-using std::stringstream;
 // Event handlers
 
 
-// socketio_client_handler::socketio_client_handler()
-// {
-//    // LOG('HERE');
-//    // m_client.clear_access_channels(websocketpp::log::alevel::all);
-//    // m_client.set_access_channels(websocketpp::log::alevel::connect);
-//    // m_client.set_access_channels(websocketpp::log::alevel::disconnect);
-//    // m_client.set_access_channels(websocketpp::log::alevel::app);
+void socketio_client_handler::init_client(boost::asio::io_service* io_service, timing_wheel* wheel)
+{
+   m_client.clear_access_channels(websocketpp::log::alevel::all);
+   m_client.set_access_channels(websocketpp::log::alevel::connect);
+   m_client.set_access_channels(websocketpp::log::alevel::disconnect);
+   m_client.set_access_channels(websocketpp::log::alevel::app);
 
-//    // // Initialize the Asio transport policy
-//    // m_client.init_asio();
+   // Initialize the Asio transport policy, sharing the pool's io_service if there is one.
+   if (io_service) m_client.init_asio(io_service);
+   else m_client.init_asio();
 
-//    // // Bind the handlers we are using
-//    // using websocketpp::lib::placeholders::_1;
-//    // using websocketpp::lib::bind;
-//    // m_client.set_open_handler(bind(&socketio_client_handler::on_open,this,::_1));
-//    // m_client.set_close_handler(bind(&socketio_client_handler::on_close,this,::_1));
-//    // m_client.set_fail_handler(bind(&socketio_client_handler::on_fail,this,::_1));
-//    // m_client.set_message_handler(bind(&socketio_client_handler::on_message,this,::_1,::_2));
-// }
+   // Standalone handlers keep their timers on a wheel of their own.
+   if (!wheel)
+   {
+      m_own_wheel.reset(new timing_wheel(m_client.get_io_service()));
+      wheel = m_own_wheel.get();
+   }
+   m_wheel = wheel;
+
+   // Bind the handlers we are using
+   using websocketpp::lib::placeholders::_1;
+   using websocketpp::lib::placeholders::_2;
+   using websocketpp::lib::bind;
+   m_client.set_open_handler(bind(&socketio_client_handler::on_open,this,_1));
+   m_client.set_close_handler(bind(&socketio_client_handler::on_close,this,_1));
+   m_client.set_fail_handler(bind(&socketio_client_handler::on_fail,this,_1));
+   m_client.set_message_handler(bind(&socketio_client_handler::on_message,this,_1,_2));
+
+   // Seeds the reconnect jitter so handlers in a fleet spread out.
+   std::random_device seed;
+   m_rng.seed(seed());
+
+   set_metrics_label(metrics_registry::instance().next_label());
+}
 
-// socketio_client_handler::~socketio_client_handler()
-// {
-//     // close();
-// }
+void socketio_client_handler::set_metrics_label(const std::string& label)
+{
+   // The gauges are sampled from the handler whenever the registry is read.
+   metrics_registry::instance().register_connection(&m_metrics, label, [this](connection_metrics& m) {
+      m.connected = m_connected;
+      m.pending_acks = m_acks.pending();
+      m.queued_packets = m_send_queue.depth();
+      m.buffered_bytes = buffered_bytes();
+   });
+}
 
 // // Websocket++ client handler
 
 void socketio_client_handler::on_fail(connection_hdl con)
 {
-   stop_heartbeat();
+   m_wire_bytes = 0;
    m_con.reset();
    m_connected = false;
+   hold_unsent();
 
-   LOG("Connection failed." << std::endl);
+   SOCKETIO_LOG(log_info, log_connection, "Connection failed.");
    if(m_con_listener)m_con_listener->on_fail(con);
+   if (m_closing) close_done();
+   connection_lost();
 }
 
 void socketio_client_handler::on_open(connection_hdl con)
 {
-   // Create the heartbeat timer and use the same io_service as the main event loop.
-   m_heartbeatTimer = std::unique_ptr<boost::asio::deadline_timer>(new boost::asio::deadline_timer(m_client.get_io_service(), boost::posix_time::seconds(0)));
+   if (m_closing)
+   {
+      // close() ran while the websocket was opening: disconnect right away.
+      m_connected = true;
+      do_close();
+      return;
+   }
 
-   start_heartbeat();
+   // Heartbeats are due every m_heartbeatTimeout seconds from now on.
+   m_heartbeat_due = timing_wheel::clock::now();
+   do_start_heartbeat();
+
+   m_last_received = timing_wheel::clock::now();
+   check_disconnect();
    m_connected = true;
 
-   LOG("Connected." << std::endl);
+   m_time_to_connected = std::chrono::duration_cast<std::chrono::microseconds>(timing_wheel::clock::now() - m_connect_started).count();
+   SOCKETIO_LOG(log_info, log_connection, "Connected in " << m_time_to_connected.load() << "us.");
+   if (m_reconnect_attempt > 0)
+   {
+      m_time_to_recover = std::chrono::duration_cast<std::chrono::microseconds>(timing_wheel::clock::now() - m_connection_lost).count();
+      ++m_reconnects;
+      count(counter_reconnects);
+      SOCKETIO_LOG(log_info, log_connection, "Recovered after " << m_reconnect_attempt << " attempt(s) in " << m_time_to_recover.load() << "us.");
+      m_reconnect_attempt = 0;
+   }
+
+   // Rejoin the endpoints of the previous connection, then send everything emitted while
+   // disconnected in one batch, before anything queued since.
+   rejoin_endpoints();
+   flush_send_queue();
+
+   SOCKETIO_LOG(log_info, log_connection, "Connected.");
    if(m_con_listener)m_con_listener->on_open(con);
 }
 
 void socketio_client_handler::on_close(connection_hdl con)
 {  
-   stop_heartbeat();
-   m_heartbeatTimer.reset();
+   m_wire_bytes = 0;
    m_connected = false;
    m_con.reset();
+   hold_unsent();
 
-   LOG("Client Disconnected." << std::endl);
+   SOCKETIO_LOG(log_info, log_connection, "Client Disconnected.");
    if(m_con_listener)m_con_listener->on_close(con);
+   if (m_closing) close_done();
+   connection_lost();
 }
 
 void socketio_client_handler::on_message(connection_hdl con, client_type::message_ptr msg)
 {
-   // Parse the incoming message according to socket.IO rules
-   parse_message(msg->get_payload());
+   process_frame(msg->get_payload());
 }
 
 // Client Functions
-// Note from websocketpp code: methods (except for perform_handshake) will be called
-// from outside the io_service.run thread and need to be careful to not touch unsynchronized
-// member variables.
+// Note from websocketpp code: methods (except for the handshake steps, which run on the
+// io thread) will be called from outside the io_service.run thread and need to be careful
+// to not touch unsynchronized member variables.
 
-std::string socketio_client_handler::perform_handshake(std::string url, std::string socketIoResource)
+void socketio_client_handler::start_handshake(const std::string& url, const std::string& socketIoResource)
 {
    using namespace boost::asio::ip;
-   // Log currently not accessible from this function, outputting to std::cout
-   LOG("Parsing websocket uri..." << std::endl);
+   SOCKETIO_LOG(log_debug, log_handshake, "Parsing websocket uri...");
    websocketpp::uri uo(url);
    m_resource = uo.get_resource();
 
-   // Declare boost io_service
-   boost::asio::io_service io_service;
+   // One deadline covers resolving, connecting and the HTTP exchange; open_websocket hands
+   // whatever is left of it to the websocket opening handshake.
+   m_connect_deadline = timing_wheel::clock::now() + std::chrono::milliseconds(m_connect_timeout.total_milliseconds());
+   m_connect_timer = m_wheel->schedule_at(m_connect_deadline, boost::bind(&socketio_client_handler::handshake_timed_out, this));
 
-   LOG("Connecting to Server..." << std::endl);
+   // A connection kept open by the previous handshake to the same server skips resolving and
+   // the TCP handshake.
+   std::shared_ptr<handshake_state> idle;
+   idle.swap(m_idle_handshake);
+   if (idle && idle->socket.is_open() && idle->host == uo.get_host() && idle->port == uo.get_port_str())
+   {
+      SOCKETIO_LOG(log_debug, log_handshake, "Reusing handshake connection...");
+      idle->reused = true;
+      idle->socket_io_resource = socketIoResource;
+      m_handshake = idle;
+      send_handshake_request(idle);
+      return;
+   }
+
+   std::shared_ptr<handshake_state> hs(new handshake_state(m_client.get_io_service()));
+   hs->host = uo.get_host();
+   hs->port = uo.get_port_str();
+   hs->socket_io_resource = socketIoResource;
+   m_handshake = hs;
+   resolve_handshake(hs);
+}
+
+void socketio_client_handler::resolve_handshake(std::shared_ptr<handshake_state> hs)
+{
+   SOCKETIO_LOG(log_debug, log_handshake, "Connecting to Server...");
 
-   // Resolve query
-   tcp::resolver r(io_service);
-   tcp::resolver::query q(uo.get_host(), uo.get_port_str());
-   tcp::socket socket(io_service);
-   boost::asio::connect(socket, r.resolve(q));
+   // Shared with every other handler in the process; a fresh answer costs no DNS query.
+   hs->lookup = resolver_cache::instance().resolve(m_client.get_io_service(), hs->host, hs->port,
+      [this, hs](const boost::system::error_code& ec, const resolver_cache::endpoints& addresses) {
+         handshake_resolved(hs, ec, addresses);
+      });
+}
+
+void socketio_client_handler::handshake_resolved(std::shared_ptr<handshake_state> hs, const boost::system::error_code& ec, const resolver_cache::endpoints& addresses)
+{
+   hs->lookup = 0;
+   if (hs != m_handshake) return;
+   if (ec)
+   {
+      handshake_failed(hs, "Could not resolve " + hs->host + ": " + ec.message());
+      return;
+   }
+   // Try every address at once rather than waiting for each to time out in turn.
+   hs->race = connect_race::start(m_client.get_io_service(), addresses,
+      [this, hs](const boost::system::error_code& ec, boost::asio::ip::tcp::socket* socket) {
+         handshake_connected(hs, ec, socket);
+      });
+}
+
+void socketio_client_handler::handshake_connected(std::shared_ptr<handshake_state> hs, const boost::system::error_code& ec, boost::asio::ip::tcp::socket* socket)
+{
+   hs->race.reset();
+   if (hs != m_handshake) return;
+   if (ec || !socket)
+   {
+      // None of the cached addresses answered; look the host up again next time.
+      resolver_cache::instance().invalidate(hs->host, hs->port);
+      handshake_failed(hs, "Could not connect to " + hs->host + ": " + ec.message());
+      return;
+   }
+   hs->socket = std::move(*socket);
+   send_handshake_request(hs);
+}
+
+void socketio_client_handler::send_handshake_request(std::shared_ptr<handshake_state> hs)
+{
+   hs->parser.reset();
+   hs->received = 0;
 
    // Form initial post request.
-   boost::asio::streambuf request;
-   std::ostream reqstream(&request);
+   hs->request = "POST " + hs->socket_io_resource + "/1/ ";
+   hs->request += m_handshake_keep_alive ? "HTTP/1.1\r\n" : "HTTP/1.0\r\n";
+   hs->request += "Host: " + hs->host + "\r\n";
+   hs->request += "Accept: */*\r\n";
+   hs->request += m_handshake_keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
 
-   reqstream << "POST " << socketIoResource << "/1/ HTTP/1.0\r\n";
-   reqstream << "Host: " << uo.get_host() << "\r\n";
-   reqstream << "Accept: */*\r\n";
-   reqstream << "Connection: close\r\n\r\n";
+   SOCKETIO_LOG(log_debug, log_handshake, "Sending Handshake Post Request...");
 
-   LOG("Sending Handshake Post Request..." << std::endl);
+   boost::asio::async_write(hs->socket, boost::asio::buffer(hs->request), [this, hs](const boost::system::error_code& ec, std::size_t) {
+      handshake_written(hs, ec);
+   });
+}
 
-   // Write request.
-   boost::asio::write(socket, request);
+void socketio_client_handler::handshake_written(std::shared_ptr<handshake_state> hs, const boost::system::error_code& ec)
+{
+   if (hs != m_handshake) return;
+   if (ec && hs->reused)
+   {
+      retry_handshake(hs);
+      return;
+   }
+   if (ec)
+   {
+      handshake_failed(hs, "Could not send handshake request: " + ec.message());
+      return;
+   }
+   hs->socket.async_read_some(boost::asio::buffer(hs->buffer), [this, hs](const boost::system::error_code& ec, std::size_t bytes) {
+      handshake_read(hs, ec, bytes);
+   });
+}
 
-   // Receive response
-   boost::asio::streambuf response;
-   boost::asio::read_until(socket, response, "\r\n");
-   // Parse response
-   std::istream resp_stream(&response);
+void socketio_client_handler::handshake_read(std::shared_ptr<handshake_state> hs, const boost::system::error_code& ec, std::size_t bytes)
+{
+   if (hs != m_handshake) return;
 
-   // Extract HTTP version, status, and message.
-   std::string httpver;
-   unsigned int status;
-   std::string status_msg;
+   // The server may have dropped a kept-alive connection while it sat idle. Nothing was
+   // received on it yet, so the request is safe to repeat on a new connection.
+   if (ec && hs->reused && hs->received == 0)
+   {
+      retry_handshake(hs);
+      return;
+   }
 
-   resp_stream >> httpver >> status;
-   std::getline(resp_stream, status_msg);
+   http_response_parser::result result;
+   std::size_t unused = 0;
+   hs->received += bytes;
+   if (ec == boost::asio::error::eof) result = hs->parser.finish();
+   else if (ec)
+   {
+      handshake_failed(hs, "Could not read handshake response: " + ec.message());
+      return;
+   }
+   else result = hs->parser.feed(hs->buffer, bytes, &unused);
 
-   // Log response
-   LOG("Received Response:" << std::endl);
-   LOG(httpver << " " << status << std::endl);
-   LOG(status_msg << std::endl);
+   if (result == http_response_parser::error)
+   {
+      handshake_failed(hs, std::string("Invalid handshake response: ") + hs->parser.error_message());
+      return;
+   }
+   if (result == http_response_parser::incomplete)
+   {
+      hs->socket.async_read_some(boost::asio::buffer(hs->buffer), [this, hs](const boost::system::error_code& ec, std::size_t bytes) {
+         handshake_read(hs, ec, bytes);
+      });
+      return;
+   }
 
-   // Read response headers. Terminated with double newline.
-   boost::asio::read_until(socket, response, "\0");
+   m_handshake.reset();
+   if (m_handshake_keep_alive && ec != boost::asio::error::eof && unused == 0 && hs->parser.response().keep_alive())
+   {
+      // Keep the connection for the next handshake (a reconnect) to the same server.
+      m_idle_handshake = hs;
+   }
+   else
+   {
+      boost::system::error_code ignored;
+      hs->socket.close(ignored);
+   }
 
-   // Log headers.
-   std::string header;
-    
-   while (std::getline(resp_stream, header) && header[0] != '\r')
+   std::string io_uri = parse_handshake_response(*hs);
+   if (io_uri.empty())
    {
-      LOG(header << std::endl);
+      handshake_failed(hs, "Handshake rejected");
+      return;
    }
+   open_websocket(io_uri);
+}
+
+std::string socketio_client_handler::parse_handshake_response(const handshake_state& hs)
+{
+   const http_response& response = hs.parser.response();
 
-   // Handle errors
-   if (!resp_stream || httpver.substr(0, 5) != "HTTP/")
+   // Log response
+   SOCKETIO_LOG(log_debug, log_handshake, "Received Response:");
+   SOCKETIO_LOG(log_debug, log_handshake, "HTTP/" << response.major << "." << response.minor << " " << response.status << " " << response.reason);
+   for (std::size_t i = 0; i < response.headers.size(); ++i)
    {
-      std::cerr << "Invalid HTTP protocol: " << httpver << std::endl;
-      return std::string();
+      SOCKETIO_LOG(log_debug, log_handshake, response.headers[i].first << ": " << response.headers[i].second);
    }
-   switch (status)
+
+   switch (response.status)
    {
    case(200):
-      LOG("Server accepted connection." << std::endl);
+      SOCKETIO_LOG(log_debug, log_handshake, "Server accepted connection.");
       break;
    case(401):
    case(503):
-      std::cerr << "Server rejected client connection" << std::endl;
+      SOCKETIO_LOG(log_warn, log_handshake, "Server rejected client connection");
       return std::string();
    default:
-      std::cerr << "Server returned unknown status code: " << status << std::endl;
-      
-      
+      SOCKETIO_LOG(log_warn, log_handshake, "Server returned unknown status code: " << response.status);
    }
 
-   // Get the body components.
-   std::string body;
-
-   std::getline(resp_stream, body, '\0');
-
-    boost::char_separator<char> sep(":");
-    boost::tokenizer< boost::char_separator<char> > tokens(body, sep);
-    std::vector<std::string> matches;
-    matches.push_back("");
-    for(auto it = tokens.begin();it!=tokens.end();++it)
-    {
-        matches.push_back(*it);
-    }
+   // Body is sid:heartbeat timeout:disconnect timeout:transports
+   boost::char_separator<char> sep(":");
+   boost::tokenizer< boost::char_separator<char> > tokens(response.body, sep);
+   std::vector<std::string> matches;
+   matches.push_back("");
+   for(auto it = tokens.begin();it!=tokens.end();++it)
+   {
+      matches.push_back(*it);
+   }
    if (matches.size()>=5)
    {
       m_sid = matches[1];
@@ -200,173 +356,537 @@ std::string socketio_client_handler::perform_handshake(std::string url, std::str
       m_transports = matches[4];
       if (m_transports.find("websocket") == std::string::npos)
       {
-         std::cerr << "Server does not support websocket transport: " << m_transports << std::endl;
+         SOCKETIO_LOG(log_warn, log_handshake, "Server does not support websocket transport: " << m_transports);
          return std::string();
       }
    }
 
    // Log socket.IO info
-   LOG(std::endl << "Session ID: " << m_sid << std::endl);
-   LOG("Heartbeat Timeout: " << m_heartbeatTimeout << std::endl);
-   LOG("Disconnect Timeout: " << m_disconnectTimeout << std::endl);
-   LOG("Allowed Transports: " << m_transports << std::endl);
+   SOCKETIO_LOG(log_debug, log_handshake, "Session ID: " << m_sid);
+   SOCKETIO_LOG(log_debug, log_handshake, "Heartbeat Timeout: " << m_heartbeatTimeout);
+   SOCKETIO_LOG(log_debug, log_handshake, "Disconnect Timeout: " << m_disconnectTimeout);
+   SOCKETIO_LOG(log_debug, log_handshake, "Allowed Transports: " << m_transports);
 
    // Form the complete connection uri. Default transport method is websocket (since we are using websocketpp).
    // If secure websocket connection is desired, replace ws with wss.
+   // The upgrade names the configured host: websocketpp builds the Host header from this uri,
+   // and virtual hosts and load balancers route on it.
    std::stringstream iouri;
-   iouri << "ws://" << uo.get_host() << ":" << uo.get_port() << socketIoResource << "/1/websocket/" << m_sid;
+   iouri << "ws://" << hs.host << ":" << hs.port << hs.socket_io_resource << "/1/websocket/" << m_sid;
    m_socketIoUri = iouri.str();
    return m_socketIoUri;
 }
 
+void socketio_client_handler::handshake_failed(std::shared_ptr<handshake_state> hs, const std::string& reason)
+{
+   boost::system::error_code ignored;
+   if (hs->lookup) resolver_cache::instance().cancel(hs->lookup);
+   hs->lookup = 0;
+   if (hs->race) hs->race->cancel();
+   hs->race.reset();
+   hs->socket.close(ignored);
+   if (hs == m_handshake) m_handshake.reset();
+   m_wheel->cancel(m_connect_timer);
+   m_connect_timer = 0;
+
+   SOCKETIO_LOG(log_warn, log_handshake, reason);
+   if(m_con_listener)m_con_listener->on_fail(m_con);
+   connection_lost();
+}
+
+void socketio_client_handler::retry_handshake(std::shared_ptr<handshake_state> hs)
+{
+   SOCKETIO_LOG(log_debug, log_handshake, "Handshake connection was closed by the server, reconnecting...");
+   boost::system::error_code ignored;
+   hs->socket.close(ignored);
+
+   std::shared_ptr<handshake_state> fresh(new handshake_state(m_client.get_io_service()));
+   fresh->host = hs->host;
+   fresh->port = hs->port;
+   fresh->socket_io_resource = hs->socket_io_resource;
+   m_handshake = fresh;
+   resolve_handshake(fresh);
+}
+
+void socketio_client_handler::handshake_timed_out()
+{
+   m_connect_timer = 0;
+   if (m_handshake) handshake_failed(m_handshake, "Handshake timed out");
+}
+
 void socketio_client_handler::send(const std::string &msg)
 {
-   if (m_con.expired())
+   send_packet(std::string(msg));
+}
+
+void socketio_client_handler::flush_send_queue()
+{
+   if (m_connected)
+   {
+      // Packets held back while disconnected go first, in the order they were emitted.
+      while (!m_replay.empty())
+      {
+         send_or_batch(m_replay.front());
+         m_replay.pop_front();
+      }
+   }
+   m_send_queue.drain([this](std::string& msg) {
+      if (!m_connected)
+      {
+         hold_packet(msg);
+         return;
+      }
+      send_or_batch(msg);
+   });
+
+   // Without a latency budget the batch goes out with this flush; otherwise it waits for
+   // more packets until the budget runs out or the frame is full.
+   if (!m_batch.empty())
+   {
+      if (m_batch_delay <= boost::posix_time::time_duration()) write_batch();
+      else if (!m_batch_timer)
+      {
+         m_batch_timer = m_wheel->schedule(std::chrono::milliseconds(m_batch_delay.total_milliseconds()), [this]() {
+            m_batch_timer = 0;
+            write_batch();
+            update_pressure();
+         });
+      }
+   }
+   update_pressure();
+}
+
+void socketio_client_handler::send_or_batch(std::string& msg)
+{
+   count_sent(msg);
+   if (m_batch_bytes_limit == 0)
    {
-      std::cerr << "Error: No active session" << std::endl;
+      write_packet(msg);
+      // From here on the bytes are websocketpp's; update_pressure reads its buffer size.
+      m_queued_bytes -= msg.size();
       return;
    }
-   stringstream ss;
-   ss<<"Sent:"<<msg<<std::endl;
-   m_client.get_alog().write(log::alevel::app,ss.str());
-   m_client.send(m_con,msg,frame::opcode::TEXT);
+   // Framing adds two markers and the length to every packet.
+   std::size_t framed = msg.size() + 2 * frame_marker_size + 10;
+   if (!m_batch.empty() && m_batch_bytes + framed > m_batch_bytes_limit) write_batch();
+   m_batch_bytes += framed;
+   m_batch.push_back(std::string());
+   m_batch.back().swap(msg);
 }
 
-void socketio_client_handler::send(unsigned int type, std::string endpoint, std::string msg, unsigned int id)
+void socketio_client_handler::write_batch()
 {
-   // Construct the message.
-   // Format: [type]:[id]:[endpoint]:[msg]
-   std::stringstream package;
-   package << type << ":";
-   if (id > 0) package << id;
-   package << ":" << endpoint << ":" << msg;
+   if (m_batch.empty()) return;
+   if (m_batch_timer)
+   {
+      m_wheel->cancel(m_batch_timer);
+      m_batch_timer = 0;
+   }
+   if (!m_connected)
+   {
+      for (std::size_t i = 0; i < m_batch.size(); ++i) hold_packet(m_batch[i]);
+   }
+   else if (m_batch.size() == 1)
+   {
+      // A lone packet doesn't need framing.
+      write_packet(m_batch[0]);
+      m_queued_bytes -= m_batch[0].size();
+   }
+   else
+   {
+      m_frame_buffer.clear();
+      std::size_t bytes = 0;
+      for (std::size_t i = 0; i < m_batch.size(); ++i)
+      {
+         append_framed(m_frame_buffer, m_batch[i]);
+         bytes += m_batch[i].size();
+      }
+      write_packet(m_frame_buffer);
+      m_queued_bytes -= bytes;
+   }
+   m_batch.clear();
+   m_batch_bytes = 0;
+}
 
-   send(package.str());
+void socketio_client_handler::set_outbound_sink(const outbound_sink& sink)
+{
+   m_outbound_sink = sink;
+   m_connected = bool(sink);
 }
 
-void socketio_client_handler::connect_endpoint(std::string endpoint)
+void socketio_client_handler::process_frame(const std::string& frame)
 {
-   std::stringstream ss;
-   ss<<type_connect<<"::"<<endpoint;
-   send(ss.str());
+   m_last_received = timing_wheel::clock::now();
+   count(counter_bytes_in, frame.size());
+   if (m_recorder) m_recorder->record(traffic_inbound, frame.data(), frame.size());
+
+   // Parse the incoming message according to socket.IO rules
+   parse_message(frame);
 }
 
-void socketio_client_handler::disconnect_endpoint(std::string endpoint)
+std::size_t socketio_client_handler::poll()
 {
-   std::stringstream ss;
-   ss<<type_disconnect<<"::"<<endpoint;
-   send(ss.str());
+   return m_client.get_io_service().poll();
 }
 
-unsigned int socketio_client_handler::s_global_event_id = 0;
+void socketio_client_handler::count_sent(const std::string& packet)
+{
+   if (!packet.empty() && packet[0] >= '0' && packet[0] <= '8') count(metric_counter(counter_packets_out + (packet[0] - '0')));
+}
 
-void socketio_client_handler::emit(std::string const& name, Document& args, std::string const& endpoint)
+void socketio_client_handler::write_packet(const std::string& msg)
 {
-   // Add the name to the data being sent.
-   Value n;
-   n.SetString(name.c_str(), name.length(), args.GetAllocator());
-   args.AddMember("name", n, args.GetAllocator());
+   SOCKETIO_LOG(log_trace, log_packet, "Sent:" << msg);
+   count(counter_bytes_out, msg.size());
+   if (m_recorder) m_recorder->record(traffic_outbound, msg.data(), msg.size());
+   if (m_outbound_sink)
+   {
+      m_outbound_sink(msg);
+      return;
+   }
+   lib::error_code ec;
+   m_client.send(m_con,msg,frame::opcode::TEXT,ec);
+   if (ec)
+   {
+      SOCKETIO_LOG(log_warn, log_packet, "Send Error: " << ec.message());
+   }
+}
 
-   // Stringify json
-   std::ostringstream outStream;
-    outStream.precision(8);
-   StreamWriter<std::ostringstream> writer(outStream);
-   args.Accept(writer);
+void socketio_client_handler::hold_packet(std::string& msg)
+{
+   // Only messages, JSON messages and events mean anything on the next connection.
+   // Heartbeats and acks belong to the session that was lost, and rejoin_endpoints sends
+   // the connects again.
+   bool replayable = msg.size() >= 2 && msg[1] == ':' && (msg[0] == '3' || msg[0] == '4' || msg[0] == '5');
+   if (!replayable)
+   {
+      m_queued_bytes -= msg.size();
+      return;
+   }
+   if (m_replay_limit == 0)
+   {
+      m_queued_bytes -= msg.size();
+      SOCKETIO_LOG(log_error, log_packet, "Error: No active session");
+      return;
+   }
+   if (m_replay.size() >= m_replay_limit)
+   {
+      // Bounded: the oldest packet makes room.
+      m_queued_bytes -= m_replay.front().size();
+      m_replay.pop_front();
+      ++m_replay_dropped;
+   }
+   m_replay.push_back(std::string());
+   m_replay.back().swap(msg);
+}
 
-   // Extract the message from the stream and format it.
-   std::string package(outStream.str());
-   send(type_event, endpoint, package.substr(0, package.find('\0')), 0);
+void socketio_client_handler::hold_unsent()
+{
+   // Hold the batch and the send queue for the next connection before any ack is failed:
+   // the server sees the held packets only after the replay, so their acks stay pending.
+   // No other ack can arrive on a closed connection; those fail in one go. Once closing,
+   // nothing more is held and every ack fails.
+   write_batch();
+   if (!m_closing) flush_send_queue();
+   cancel_timers(!m_closing);
 }
 
-void socketio_client_handler::emit(std::string const& name, Document& args, std::string const& endpoint, std::function<void (void)> ack)
+void socketio_client_handler::update_pressure()
 {
-   Value n;
-   n.SetString(name.c_str(), name.length(), args.GetAllocator());
-   args.AddMember("name", n, args.GetAllocator());
+   std::size_t wire = 0;
+   if (m_connected)
+   {
+      lib::error_code ec;
+      client_type::connection_ptr con = m_client.get_con_from_hdl(m_con, ec);
+      if (!ec && con) wire = con->get_buffered_amount();
+   }
+   m_wire_bytes = wire;
+   std::size_t buffered = m_queued_bytes + wire;
 
-   // Stringify json
-   std::ostringstream outStream;
-   StreamWriter<std::ostringstream> writer(outStream);
-   args.Accept(writer);
+   if (m_high_watermark > 0 && !m_pressure && buffered >= m_high_watermark)
+   {
+      m_pressure = true;
+      if(m_con_listener)m_con_listener->on_pressure(m_con, buffered);
+   }
+   else if (m_pressure && (m_high_watermark == 0 || buffered <= m_low_watermark))
+   {
+      m_pressure = false;
+      if(m_con_listener)m_con_listener->on_drain(m_con, buffered);
+   }
 
-   // Extract the message from the stream and format it.
-   std::string package(outStream.str());
-   m_acks[++s_global_event_id] = ack;
-   send(type_event, endpoint, package.substr(0, package.find('\0')), s_global_event_id);
+   if (m_room_waiters > 0)
+   {
+      std::lock_guard<std::mutex> lock(m_room_mutex);
+      m_room_available.notify_all();
+   }
+
+   // websocketpp doesn't report writes completing, so keep looking while it matters.
+   if ((m_pressure || m_room_waiters > 0) && m_connected && !m_pressure_timer)
+   {
+      m_pressure_timer = m_wheel->schedule(std::chrono::milliseconds(10), [this]() {
+         m_pressure_timer = 0;
+         update_pressure();
+      });
+   }
 }
 
-void socketio_client_handler::emit(std::string const& name, std::string const& arg0, std::string const& endpoint) {
-   Document d;
-   d.SetObject();
-   Value args;
-   args.SetArray();
-   args.PushBack(arg0.c_str(), d.GetAllocator());
-   d.AddMember("args", args, d.GetAllocator());
+bool socketio_client_handler::wait_for_room(boost::posix_time::time_duration const& wait)
+{
+   if (m_high_watermark == 0 || buffered_bytes() < m_high_watermark) return true;
+   if (wait <= boost::posix_time::time_duration()) return false;
+
+   std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait.total_milliseconds());
+   std::unique_lock<std::mutex> lock(m_room_mutex);
+   ++m_room_waiters;
+   // Make sure the io thread is watching the buffer on this waiter's behalf.
+   m_client.get_io_service().post(lib::bind(&socketio_client_handler::update_pressure,this));
+   bool room = m_room_available.wait_until(lock, deadline, [this]() {
+      return m_high_watermark == 0 || buffered_bytes() < m_high_watermark;
+   });
+   --m_room_waiters;
+   return room;
+}
+
+bool socketio_client_handler::try_emit(std::string const& name, Document& args, std::string const& endpoint, boost::posix_time::time_duration const& wait)
+{
+   if (!wait_for_room(wait)) return false;
+   emit(name, args, endpoint);
+   return true;
+}
+
+bool socketio_client_handler::try_emit(std::string const& name, std::string const& arg0, std::string const& endpoint, boost::posix_time::time_duration const& wait)
+{
+   if (!wait_for_room(wait)) return false;
+   emit(name, arg0, endpoint);
+   return true;
+}
 
-   emit(name, d, endpoint);
+void socketio_client_handler::rejoin_endpoints()
+{
+   std::vector<std::string> endpoints;
+   {
+      std::lock_guard<std::mutex> lock(m_endpoints_mutex);
+      endpoints.assign(m_endpoints.begin(), m_endpoints.end());
+   }
+   for (std::size_t i = 0; i < endpoints.size(); ++i)
+   {
+      std::string packet;
+      m_encoder.encode_endpoint(packet, type_connect, endpoints[i]);
+      count_sent(packet);
+      write_packet(packet);
+   }
+}
+
+void socketio_client_handler::connection_lost()
+{
+   if (m_closing || !m_reconnect || m_reconnect_timer) return;
+   if (m_reconnect_max_attempts > 0 && m_reconnect_attempt >= m_reconnect_max_attempts)
+   {
+      SOCKETIO_LOG(log_warn, log_connection, "Giving up reconnecting.");
+      m_reconnect_attempt = 0;
+      return;
+   }
+   if (m_reconnect_attempt == 0) m_connection_lost = timing_wheel::clock::now();
+
+   // Exponential backoff capped at the maximum delay, minus a random share of up to m_reconnect_jitter
+   // so a fleet that lost the same server doesn't come back in lockstep.
+   double delay = double(m_reconnect_delay.total_milliseconds());
+   for (unsigned int i = 0; i < m_reconnect_attempt && delay < m_reconnect_max_delay.total_milliseconds(); ++i) delay *= 2;
+   if (delay > m_reconnect_max_delay.total_milliseconds()) delay = double(m_reconnect_max_delay.total_milliseconds());
+   std::uniform_real_distribution<double> jitter(0.0, m_reconnect_jitter);
+   delay *= 1.0 - jitter(m_rng);
+
+   ++m_reconnect_attempt;
+   SOCKETIO_LOG(log_info, log_connection, "Reconnecting in " << long(delay) << "ms (attempt " << m_reconnect_attempt << ").");
+   m_reconnect_timer = m_wheel->schedule(std::chrono::milliseconds(long(delay)), [this]() {
+      m_reconnect_timer = 0;
+      start_connect(m_uri);
+   });
+}
+
+void socketio_client_handler::send(unsigned int type, const std::string& endpoint, const std::string& msg, unsigned int id)
+{
+   // Construct the message.
+   // Format: [type]:[id]:[endpoint]:[msg]
+   std::string packet;
+   m_encoder.encode(packet, type, endpoint, msg, id);
+   send_packet(std::move(packet));
+}
+
+void socketio_client_handler::send_packet(std::string&& packet)
+{
+   m_queued_bytes += packet.size();
+   // Only the first packet of a batch wakes the io thread; the rest ride along.
+   if (m_send_queue.push(std::move(packet)))
+   {
+      m_client.get_io_service().post(lib::bind(&socketio_client_handler::flush_send_queue,this));
+   }
+}
+
+void socketio_client_handler::connect_endpoint(const std::string& endpoint)
+{
+   {
+      std::lock_guard<std::mutex> lock(m_endpoints_mutex);
+      m_endpoints.insert(endpoint);
+   }
+   std::string packet;
+   m_encoder.encode_endpoint(packet, type_connect, endpoint);
+   send_packet(std::move(packet));
+}
+
+void socketio_client_handler::disconnect_endpoint(const std::string& endpoint)
+{
+   {
+      std::lock_guard<std::mutex> lock(m_endpoints_mutex);
+      m_endpoints.erase(endpoint);
+   }
+   std::string packet;
+   m_encoder.encode_endpoint(packet, type_disconnect, endpoint);
+   send_packet(std::move(packet));
+}
+
+void socketio_client_handler::emit(std::string const& name, Document& args, std::string const& endpoint)
+{
+   // The name is written ahead of args' members, straight into the packet.
+   std::string packet;
+   m_encoder.encode_event(packet, endpoint, name, args, 0);
+   send_packet(std::move(packet));
+}
+
+void socketio_client_handler::emit(std::string const& name, Document& args, std::string const& endpoint, std::function<void (void)> ack)
+{
+   emit(name, args, endpoint, ack, m_ack_timeout, std::function<void (void)>());
+}
+
+void socketio_client_handler::emit(std::string const& name, Document& args, std::string const& endpoint, std::function<void (void)> ack,
+   boost::posix_time::time_duration const& timeout, std::function<void (void)> on_timeout)
+{
+   unsigned int id = register_ack(ack, timeout, on_timeout, name);
+   std::string packet;
+   m_encoder.encode_event(packet, endpoint, name, args, id);
+   send_packet(std::move(packet));
+}
+
+void socketio_client_handler::emit(std::string const& name, std::string const& arg0, std::string const& endpoint) {
+   emit(name, socketio::args(arg0), endpoint);
 }
 
 void socketio_client_handler::emit(std::string const& name, std::string const& arg0, std::string const& endpoint, std::function<void (void)> ack) {
-   Document d;
-   d.SetObject();
-   Value args;
-   args.SetArray();
-   args.PushBack(arg0.c_str(), d.GetAllocator());
-   d.AddMember("args", args, d.GetAllocator());
+   emit(name, socketio::args(arg0), endpoint, ack);
+}
 
-   emit(name, d, endpoint,ack);
+void socketio_client_handler::emit(std::string const& name, std::string const& arg0, std::string const& endpoint, std::function<void (void)> ack,
+   boost::posix_time::time_duration const& timeout, std::function<void (void)> on_timeout) {
+   emit(name, socketio::args(arg0), endpoint, ack, timeout, on_timeout);
 }
 
 
-void socketio_client_handler::message(std::string msg, std::string endpoint)
+void socketio_client_handler::message(const std::string& msg, const std::string& endpoint)
 {
-   send(3, endpoint, msg, 0);
+   send(type_message, endpoint, msg, 0);
 }
 
 
-void socketio_client_handler::message(std::string msg, std::string endpoint, std::function<void (void)>  const& ack)
+void socketio_client_handler::message(const std::string& msg, const std::string& endpoint, std::function<void (void)>  const& ack)
 {
-   m_acks[++s_global_event_id] = ack;
-   send(3, endpoint, msg, s_global_event_id);
+   send(type_message, endpoint, msg, register_ack(ack, m_ack_timeout, std::function<void (void)>(), "message"));
 }
 
-void socketio_client_handler::json_message(Document& json, std::string endpoint)
+void socketio_client_handler::json_message(Document& json, const std::string& endpoint)
 {
-   // Stringify json
-   std::ostringstream outStream;
-   StreamWriter<std::ostringstream> writer(outStream);
-   json.Accept(writer);
+   std::string packet;
+   m_encoder.encode_json(packet, type_json, endpoint, json, 0);
+   send_packet(std::move(packet));
+}
 
-   // Extract the message from the stream and format it.
-   std::string package(outStream.str());
-   send(4, endpoint, package.substr(0, package.find('\0')), 0);
+void socketio_client_handler::json_message(Document& json, const std::string& endpoint, std::function<void (void)>  const& ack)
+{
+   unsigned int id = register_ack(ack, m_ack_timeout, std::function<void (void)>(), "json");
+   std::string packet;
+   m_encoder.encode_json(packet, type_json, endpoint, json, id);
+   send_packet(std::move(packet));
 }
 
-void socketio_client_handler::json_message(Document& json, std::string endpoint, std::function<void (void)>  const& ack)
+socketio_client_handler::socketio_client_handler(socketio_client_pool* pool) : m_heartbeatTimeout(0),
+   m_disconnectTimeout(0),
+   m_connected(false),
+   m_insitu_parsing(false),
+   m_ack_timeout(boost::posix_time::seconds(60)),
+   m_handshake_keep_alive(false),
+   m_connect_timeout(boost::posix_time::seconds(20)),
+   m_connect_timer(0),
+   m_time_to_connected(0),
+   m_closing(false),
+   m_reconnect(false),
+   m_reconnect_max_attempts(0),
+   m_reconnect_delay(boost::posix_time::seconds(1)),
+   m_reconnect_max_delay(boost::posix_time::seconds(30)),
+   m_reconnect_jitter(0.5),
+   m_reconnect_attempt(0),
+   m_reconnect_timer(0),
+   m_reconnects(0),
+   m_time_to_recover(0),
+   m_replay_limit(1024),
+   m_replay_dropped(0),
+   m_queued_bytes(0),
+   m_wire_bytes(0),
+   m_high_watermark(1024 * 1024),
+   m_low_watermark(256 * 1024),
+   m_pressure(false),
+   m_pressure_timer(0),
+   m_room_waiters(0),
+   m_batch_bytes_limit(0),
+   m_batch_bytes(0),
+   m_batch_timer(0),
+   m_wheel(NULL),
+   m_heartbeat_timer(0),
+   m_disconnect_timer(0),
+   m_network_thread(NULL),
+   m_pool(pool),
+   m_closed(false),
+   m_heartbeatActive(false),
+   m_con_listener(NULL)
 {
-   m_acks[++s_global_event_id] = ack;
-   // Stringify json
-   std::ostringstream outStream;
-   StreamWriter<std::ostringstream> writer(outStream);
-   json.Accept(writer);
+}
 
-   // Extract the message from the stream and format it.
-   std::string package(outStream.str());
-   send(4, endpoint, package.substr(0, package.find('\0')), s_global_event_id);
+socketio_client_handler::~socketio_client_handler()
+{
+   // The pool's loop and wheel outlive the handler: nothing on them may still point at it.
+   // m_wheel is NULL if the constructor didn't get as far as init_client.
+   if (m_pool && m_wheel && !on_io_thread())
+   {
+      bool closed;
+      {
+         std::lock_guard<std::mutex> lock(m_close_mutex);
+         closed = m_closed;
+      }
+      if (!m_uri.empty() && !closed) close();
+      else run_on_io_thread([this]() { cancel_timers(); });
+   }
+   metrics_registry::instance().unregister_connection(&m_metrics);
 }
 
 void socketio_client_handler::close()
 {
-   if (m_con.expired())
+   if (m_pool && !on_io_thread())
    {
-      std::cerr << "Error: No active session" << std::endl;
+      {
+         std::lock_guard<std::mutex> lock(m_close_mutex);
+         m_closed = false;
+      }
+      m_client.get_io_service().post(lib::bind(&socketio_client_handler::do_close,this));
+      {
+         std::unique_lock<std::mutex> lock(m_close_mutex);
+         m_close_done.wait(lock, [this]() { return m_closed; });
+      }
+      // The completions of whatever do_close aborted, and websocketpp's own cleanup after
+      // on_close, are queued behind it; let them run out, then clear anything they armed.
+      run_on_io_thread([this]() { cancel_timers(); });
+      return;
    }
-    else
-    {
-        send(3, "disconnect", "");
-        m_client.close(m_con,close::status::normal,"Ended by user");
-    }
-    if(m_network_thread)
+
+   m_client.get_io_service().post(lib::bind(&socketio_client_handler::do_close,this));
+    if(m_network_thread && m_network_thread->get_id() != std::this_thread::get_id())
     {
         m_network_thread->join();
         delete m_network_thread;
@@ -375,7 +895,100 @@ void socketio_client_handler::close()
     }
 }
 
+void socketio_client_handler::do_close()
+{
+   // A closed handler stays closed: no reconnect, and nothing left to replay.
+   m_closing = true;
+   m_wheel->cancel(m_reconnect_timer);
+   m_reconnect_timer = 0;
+   m_reconnect_attempt = 0;
+   for (std::size_t i = 0; i < m_replay.size(); ++i) m_queued_bytes -= m_replay[i].size();
+   m_replay.clear();
+
+   // Without a reconnect the kept-alive handshake connection has no further use.
+   if (m_idle_handshake)
+   {
+      boost::system::error_code ignored;
+      m_idle_handshake->socket.close(ignored);
+      m_idle_handshake.reset();
+   }
+
+   if (m_handshake)
+   {
+      // Still handshaking: abandon it. Its pending operations complete as aborted, and a
+      // lookup still in flight forgets it.
+      boost::system::error_code ignored;
+      if (m_handshake->lookup) resolver_cache::instance().cancel(m_handshake->lookup);
+      m_handshake->lookup = 0;
+      if (m_handshake->race) m_handshake->race->cancel();
+      m_handshake->race.reset();
+      m_handshake->socket.close(ignored);
+      m_handshake.reset();
+      // No on_close will follow to clean up, so nothing may stay on the wheel.
+      cancel_timers();
+      close_done();
+   }
+   else if (m_con.expired())
+   {
+      SOCKETIO_LOG(log_error, log_packet, "Error: No active session");
+      cancel_timers();
+      close_done();
+   }
+   else if (!m_connected)
+   {
+      // The websocket is still opening. Sending the disconnect now would only hold it for
+      // the next connection, and websocketpp won't close a connection before it is open;
+      // on_open sees m_closing and finishes the close.
+      SOCKETIO_LOG(log_info, log_connection, "Closing once the connection is open.");
+   }
+    else
+    {
+        send(3, "disconnect", "");
+        // Write anything still queued (including the disconnect) before closing.
+        flush_send_queue();
+        write_batch();
+        lib::error_code ec;
+        m_client.close(m_con,close::status::normal,"Ended by user",ec);
+    }
+}
+
+void socketio_client_handler::close_done()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_close_mutex);
+      m_closed = true;
+   }
+   m_close_done.notify_all();
+}
+
+bool socketio_client_handler::on_io_thread() const
+{
+   if (m_pool) return std::this_thread::get_id() == m_io_thread;
+   return m_network_thread && m_network_thread->get_id() == std::this_thread::get_id();
+}
+
+void socketio_client_handler::run_on_io_thread(const std::function<void (void)>& f)
+{
+   std::promise<void> done;
+   std::future<void> finished = done.get_future();
+   m_client.get_io_service().post([&f, &done]() {
+      f();
+      done.set_value();
+   });
+   finished.wait();
+}
+
 void socketio_client_handler::start_heartbeat()
+{
+   m_client.get_io_service().dispatch(boost::bind(&socketio_client_handler::do_start_heartbeat, this));
+}
+
+void socketio_client_handler::stop_heartbeat()
+{
+   m_client.get_io_service().dispatch(boost::bind(&socketio_client_handler::do_stop_heartbeat, this));
+}
+
+void socketio_client_handler::do_start_heartbeat()
 {
    // Heartbeat is already active so don't do anything.
    if (m_heartbeatActive) return;
@@ -383,241 +996,450 @@ void socketio_client_handler::start_heartbeat()
    // Check valid heartbeat wait time.
    if (m_heartbeatTimeout > 0)
    {
-      m_heartbeatTimer->expires_at(m_heartbeatTimer->expires_at() + boost::posix_time::seconds(m_heartbeatTimeout));
+      m_heartbeat_due += std::chrono::seconds(m_heartbeatTimeout);
       m_heartbeatActive = true;
-      m_heartbeatTimer->async_wait(boost::bind(&socketio_client_handler::heartbeat, this));
-      stringstream ss("Sending heartbeats. Timeout: ");
-      ss<< m_heartbeatTimeout << std::endl;
-      m_client.get_alog().write(log::alevel::devel,ss.str()) ;
+      m_heartbeat_timer = m_wheel->schedule_at(m_heartbeat_due, boost::bind(&socketio_client_handler::heartbeat, this));
+      SOCKETIO_LOG(log_debug, log_connection, "Sending heartbeats. Timeout: " << m_heartbeatTimeout);
    }
 }
 
-void socketio_client_handler::stop_heartbeat()
+void socketio_client_handler::do_stop_heartbeat()
 {
    // Timer is already stopped.
    if (!m_heartbeatActive) return;
 
    // Stop the heartbeats.
    m_heartbeatActive = false;
-   m_heartbeatTimer->cancel();
+   m_wheel->cancel(m_heartbeat_timer);
+   m_heartbeat_timer = 0;
 
-   m_client.get_alog().write(log::alevel::devel,"Stopped sending heartbeats.\n") ;
+   SOCKETIO_LOG(log_debug, log_connection, "Stopped sending heartbeats.");
 }
 
 void socketio_client_handler::send_heartbeat()
 {
-   std::stringstream ss;
-   ss<<type_heartbeat<<"::";
-   send(ss.str());
-   m_client.get_alog().write(log::alevel::devel,"Sent Heartbeat.\n") ;
+   std::string packet;
+   m_encoder.encode_endpoint(packet, type_heartbeat, "");
+   send_packet(std::move(packet));
+   SOCKETIO_LOG(log_debug, log_connection, "Sent Heartbeat.");
 }
 
 void socketio_client_handler::heartbeat()
 {
    send_heartbeat();
 
-   m_heartbeatTimer->expires_at(m_heartbeatTimer->expires_at() + boost::posix_time::seconds(m_heartbeatTimeout));
-   m_heartbeatTimer->async_wait(boost::bind(&socketio_client_handler::heartbeat, this));
+   // Re-arm from the previous due time rather than now so heartbeats don't drift.
+   m_heartbeat_due += std::chrono::seconds(m_heartbeatTimeout);
+   m_heartbeat_timer = m_wheel->schedule_at(m_heartbeat_due, boost::bind(&socketio_client_handler::heartbeat, this));
+}
+
+void socketio_client_handler::check_disconnect()
+{
+   m_disconnect_timer = 0;
+   if (m_disconnectTimeout == 0) return;
+
+   // Re-check at the moment the server would be overdue; messages that arrived in the
+   // meantime just push the check further out.
+   timing_wheel::clock::time_point deadline = m_last_received + std::chrono::seconds(m_disconnectTimeout);
+   if (timing_wheel::clock::now() < deadline)
+   {
+      m_disconnect_timer = m_wheel->schedule_at(deadline, boost::bind(&socketio_client_handler::check_disconnect, this));
+      return;
+   }
+
+   SOCKETIO_LOG(log_warn, log_connection, "Nothing received within the disconnect timeout, closing.");
+   count(counter_heartbeat_misses);
+   lib::error_code ec;
+   m_client.close(m_con, close::status::going_away, "disconnect timeout", ec);
 }
 
 void socketio_client_handler::parse_message(const std::string &msg)
+{
+   // A frame holds either one packet or several, each prefixed with \ufffd[length]\ufffd.
+   if (!is_framed(msg.data(), msg.size()))
+   {
+      handle_packet(msg);
+      return;
+   }
+   const char* p = msg.data();
+   const char* end = p + msg.size();
+   boost::string_ref packet;
+   while (next_framed_packet(p, end, packet))
+   {
+      handle_packet(packet);
+   }
+   if (p != end)
+   {
+      SOCKETIO_LOG(log_warn, log_packet, "Malformed multi-packet frame");
+      count(counter_parse_errors);
+   }
+}
+
+void socketio_client_handler::handle_packet(boost::string_ref msg)
 {
    // Parse response according to socket.IO rules.
    // https://github.com/LearnBoost/socket.io-spec
+   // The packet fields are views into msg; nothing is copied unless a listener needs a std::string.
+   packet_view packet;
+   if (!parse_packet(msg.data(), msg.size(), packet))
+   {
+      SOCKETIO_LOG(log_warn, log_packet, "Non-Socket.IO message: " << msg);
+      count(counter_parse_errors);
+      return;
+   }
+   if (packet.type >= 0 && packet.type <= 8) count(metric_counter(counter_packets_in + packet.type));
 
-// const boost::regex expression("([0-8]):([0-9]*):([^:]*)[:]?(.*)");
-
-//    boost::char_separator<char> sep(":");
-//    boost::tokenizer< boost::char_separator<char> > tokens(msg, sep);
-    
-    
-    std::vector<std::string> matches;
-    matches.push_back("");
-    int pos = -1;
-    bool remind = true;
-    for (int i =0; i<3; ++i) {
-        int nextpos = msg.find(':',pos+1);
-        
-        if(nextpos == std::string::npos)
-        {
-            matches.push_back(msg.substr(pos+1));
-            remind = false;
-            break;
-        }
-        matches.push_back(msg.substr(pos+1,nextpos - pos - 1));
-        pos = nextpos;
-    }
-    
-    if (remind) {
-        matches.push_back(msg.substr(pos+1));
-    }
-  
-    if(matches.size()>2)
+   switch (packet.type)
    {
-      int type;
-      int msgId;
-      Document json;
+      // Disconnect
+   case (0):
+      SOCKETIO_LOG(log_trace, log_packet, "Received message type 0 (Disconnect)");
+      close();
+      break;
+      // Connection Acknowledgement
+   case (1):
+      {
+         SOCKETIO_LOG(log_trace, log_packet, "Received Message type 1 (Connect ACK): " << msg);
+         break;
+      }
+      // Heartbeat
+   case (2):
+      {
+         SOCKETIO_LOG(log_trace, log_packet, "Received Message type 2 (Heartbeat)");
+         send_heartbeat();
+         break;
+      }
+      // Message
+   case (3):
+      {
+         SOCKETIO_LOG(log_trace, log_packet, "Received Message type 3 (Message): " << msg);
+         socketio_namespace* ns = namespace_for(packet.endpoint);
+         m_data_buffer.assign(packet.data.data(), packet.data.size());
+         on_socketio_message(packet.id, endpoint_name(packet, ns), m_data_buffer, ns);
+         break;
+      }
+      // JSON Message
+   case (4):
+      {
+         SOCKETIO_LOG(log_trace, log_packet, "Received Message type 4 (JSON Message): " << msg);
+         parse_json_packet(packet, namespace_for(packet.endpoint));
+         break;
+      };
+      // Event
+   case (5):
+      {
+         SOCKETIO_LOG(log_trace, log_packet, "Received Message type 5 (Event): " << msg);
+         parse_event_packet(packet, namespace_for(packet.endpoint));
+         break;
+      }
+      // Ack
+   case (6):
+      {
+         SOCKETIO_LOG(log_trace, log_packet, "Received Message type 6 (ACK)");
+         on_socketio_ack(packet.data);
+         break;
+      }
+      // Error
+   case (7):
+      {
+         SOCKETIO_LOG(log_trace, log_packet, "Received Message type 7 (Error): " << msg);
+         // Data is "[reason]+[advice]".
+         std::size_t plus = packet.data.find('+');
+         boost::string_ref reason = packet.data.substr(0, plus);
+         boost::string_ref advice = plus == boost::string_ref::npos ? packet.data.substr(packet.data.size()) : packet.data.substr(plus + 1);
+         socketio_namespace* ns = namespace_for(packet.endpoint);
+         m_data_buffer.assign(reason.data(), reason.size());
+         m_advice_buffer.assign(advice.data(), advice.size());
+         on_socketio_error(endpoint_name(packet, ns), m_data_buffer, m_advice_buffer, ns);
+         break;
+      }
+      // Noop
+   case (8):
+      {
+         SOCKETIO_LOG(log_trace, log_packet, "Received Message type 8 (Noop)");
+         break;
+      }
+   default:
+      break;
+   }
+}
+
+socketio_namespace* socketio_client_handler::namespace_for(boost::string_ref endpoint)
+{
+   socketio_namespace** ns = m_namespace_index.find(endpoint.data(), endpoint.size());
+   return ns ? *ns : NULL;
+}
+
+const std::string& socketio_client_handler::endpoint_name(const packet_view& packet, socketio_namespace* ns)
+{
+   if (ns) return ns->m_name;
+   m_endpoint_buffer.assign(packet.endpoint.data(), packet.endpoint.size());
+   return m_endpoint_buffer;
+}
+
+socketio_client_handler::event_handler* socketio_client_handler::find_handler(socketio_namespace* ns, const char* name, std::size_t length, boost::uint64_t hash)
+{
+   event_handler* handler = ns ? ns->m_routes.handlers.find(name, length, hash) : NULL;
+   return handler ? handler : m_routes.handlers.find(name, length, hash);
+}
+
+socketio::event_stream_listener* socketio_client_handler::find_stream(socketio_namespace* ns, const char* name, std::size_t length, boost::uint64_t hash)
+{
+   event_stream_listener** listener = ns ? ns->m_routes.streams.find(name, length, hash) : NULL;
+   if (!listener) listener = m_routes.streams.find(name, length, hash);
+   return listener ? *listener : NULL;
+}
 
-      // Attempt to parse the first match as an int.
-      std::stringstream convert(matches[1]);
-      if (!(convert >> type)) type = -1;
+socketio_client_handler::socketio_listener* socketio_client_handler::listener_for(socketio_namespace* ns)
+{
+   return ns && ns->m_routes.listener ? ns->m_routes.listener : m_routes.listener;
+}
 
-      // Store second param for parsing as message id. Not every type has this, so if it's missing we just use 0 as the ID.
-      std::stringstream convertId(matches[2]);
-      if (!(convertId >> msgId)) msgId = 0;
+void socketio_client_handler::parse_event_packet(const packet_view& packet, socketio_namespace* ns)
+{
+   // A socketio_listener wants every event; then only stream listeners gain from routing
+   // on the name first.
+   socketio_listener* io_listener = listener_for(ns);
+   if (io_listener && m_routes.streams.empty() && (!ns || ns->m_routes.streams.empty()))
+   {
+      parse_json_packet(packet, ns);
+      return;
+   }
 
-      switch (type)
+   // socket.io writes the name first, and then the name alone decides; args is only
+   // looked at when the event is wanted. Other bodies are scanned in full.
+   const char* data = packet.data.data();
+   std::size_t length = packet.data.size();
+   event_scan scan;
+   bool scanned = false;
+   if (!peek_event_name(data, length, scan.name))
+   {
+      if (!scan_event(data, length, scan))
       {
-         // Disconnect
-      case (0):
-         m_client.get_alog().write(log::alevel::devel, "Received message type 0 (Disconnect)\n") ;
-         close();
-         break;
-         // Connection Acknowledgement
-      case (1):
-         {
-            stringstream ss("Received Message type 1 (Connect ACK): ");
-            ss<<msg<<std::endl;
-            m_client.get_alog().write(log::alevel::devel,ss.str());
-            break;
-         }
-         // Heartbeat
-      case (2):
-         {
-            m_client.get_alog().write(log::alevel::devel, "Received Message type 2 (Heartbeat)\n") ; 
-            send_heartbeat();
-            break;
-         }
-         // Message
-      case (3):
-         {
-            stringstream ss("Received Message type 3 (Message): ");
-            ss<<msg<<std::endl;
-            m_client.get_alog().write(log::alevel::devel,ss.str());
-            on_socketio_message(msgId, matches[3], matches[4]);
-            break;
-         }
-         // JSON Message
-      case (4):
-         {
-            stringstream ss("Received Message type 4 (JSON Message): ");
-            ss<<msg<<std::endl;
-            m_client.get_alog().write(log::alevel::devel,ss.str());
-
-            // Parse JSON
-            if (json.Parse<0>(matches[4].data()).HasParseError())
-            {
-               m_client.get_elog().write(log::elevel::warn, "Json Parse Error\n") ; 
-               return;
-            }
-            on_socketio_json(msgId, matches[3], json);
-            break;
-         };
-         // Event
-      case (5):
-         {
-            stringstream ss("Received Message type 5 (Event): ");
-            ss<<msg<<std::endl;
-            m_client.get_alog().write(log::alevel::devel,ss.str());
-
-            // Parse JSON
-            if (json.Parse<0>(matches[4].c_str()).HasParseError())
-            {
-               m_client.get_elog().write(log::elevel::warn, "Json Parse Error\n") ; 
-               return;
-            }
-            if (!json["name"].IsString())
-            {
-               m_client.get_elog().write(log::elevel::warn, "Json Parse Error\n") ; 
-               return;
-            }
-            on_socketio_event(msgId, matches[3], json["name"].GetString(), json["args"]);
-            break;
-         }
-         // Ack
-      case (6):
-         {
-            m_client.get_alog().write(log::alevel::devel, "Received Message type 6 (ACK)\n") ;
-            on_socketio_ack(matches[4]);
-            break;
-         }
-         // Error
-      case (7):
-         {
-            stringstream ss("Received Message type 7 (Error): ");
-            ss<<msg<<std::endl;
-            m_client.get_alog().write(log::alevel::devel,ss.str());
-            on_socketio_error(matches[3], matches[4].substr(0, matches[4].find("+")), matches[4].substr(matches[4].find("+")+1));
-            break;
-         }
-         // Noop
-      case (8):
-         {
-            m_client.get_alog().write(log::alevel::devel, "Received Message type 8 (Noop)\n");
-            break;
-         }
-      default:
-         break;
+         parse_json_packet(packet, ns);
+         return;
+      }
+      scanned = true;
+   }
+
+   boost::uint64_t hash = hash_name(scan.name.data(), scan.name.size());
+   event_stream_listener* listener = find_stream(ns, scan.name.data(), scan.name.size(), hash);
+   if (listener)
+   {
+      if (scanned || scan_event(data, length, scan))
+      {
+         stream_event(packet, ns, scan, *listener);
+         return;
       }
    }
+   else if (!io_listener && !find_handler(ns, scan.name.data(), scan.name.size(), hash))
+   {
+      // Nobody is interested, but the server still expects its ack.
+      count(counter_events_dropped);
+      if (packet.id > 0) this->ack(packet.id, std::string());
+      return;
+   }
+   parse_json_packet(packet, ns);
+}
+
+void socketio_client_handler::stream_event(const packet_view& packet, socketio_namespace* ns, const event_scan& scan, event_stream_listener& listener)
+{
+   listener.begin_event(endpoint_name(packet, ns));
+   if (scan.args_begin)
+   {
+      if (!m_stream_parser.parse(scan.args_begin, scan.args_end, listener))
+      {
+         SOCKETIO_LOG(log_warn, log_packet, "Json Parse Error: " << m_stream_parser.error());
+         count(counter_parse_errors);
+         listener.abort_event();
+         return;
+      }
+   }
+   this->on_socketio_proxy(packet.id,[&](std::string* ack_response){
+      listener.end_event(ack_response);
+   });
+}
+
+void socketio_client_handler::parse_json_packet(const packet_view& packet, socketio_namespace* ns)
+{
+   if (m_insitu_parsing)
+   {
+      // Strings in the Document point into the parser's copy of the payload.
+      dispatch_json_packet(packet, ns, m_json_parser.parse(packet.data.data(), packet.data.size()));
+   }
    else
    {
-      stringstream ss("Non-Socket.IO message: ");
-      ss<<msg<<std::endl;
-      m_client.get_elog().write(log::elevel::warn, ss.str());
+      // Bounded by the packet: in a multi-packet frame the next packet follows right after.
+      range_stream stream(packet.data.data(), packet.data.data() + packet.data.size());
+      Document json;
+      json.ParseStream<0, UTF8<> >(stream);
+      dispatch_json_packet(packet, ns, json);
+   }
+}
+
+void socketio_client_handler::dispatch_json_packet(const packet_view& packet, socketio_namespace* ns, Document& json)
+{
+   if (json.HasParseError())
+   {
+      SOCKETIO_LOG(log_warn, log_packet, "Json Parse Error");
+      count(counter_parse_errors);
+      return;
+   }
+   const std::string& endpoint = endpoint_name(packet, ns);
+   if (packet.type == type_json)
+   {
+      on_socketio_json(packet.id, endpoint, json, ns);
+      return;
+   }
+   if (!json["name"].IsString())
+   {
+      SOCKETIO_LOG(log_warn, log_packet, "Json Parse Error");
+      count(counter_parse_errors);
+      return;
    }
+   on_socketio_event(packet.id, endpoint, json["name"], json["args"], ns);
 }
 
 void socketio_client_handler::connect(const std::string& uri)
 {
+   m_uri = uri;
+   {
+      std::lock_guard<std::mutex> lock(m_close_mutex);
+      m_closed = false;
+   }
+   if (m_pool)
+   {
+      // Pooled handlers share the pool's event loop, so just queue the connect on it.
+      m_client.get_io_service().post(lib::bind(&socketio_client_handler::start_connect,this,uri));
+      return;
+   }
    m_network_thread = new lib::thread(lib::bind(&socketio_client_handler::run_loop,this,uri));//uri lifecycle?
 }
 
+void socketio_client_handler::start_connect(const std::string & uri)
+{
+    m_closing = false;
+    m_wheel->cancel(m_reconnect_timer);
+    m_reconnect_timer = 0;
+    m_connect_started = timing_wheel::clock::now();
+    try
+    {
+        // Resolving, connecting and the handshake request all run asynchronously on the
+        // handler's io_service; open_websocket picks up once the server has answered.
+        start_handshake(uri);
+    }
+    catch(std::exception const& e)
+    {
+        SOCKETIO_LOG(log_error, log_handshake, "connect fail:" << e.what());
+    }
+}
+
+void socketio_client_handler::open_websocket(const std::string& io_uri)
+{
+    lib::error_code ec;
+    client_type::connection_ptr con = m_client.get_connection(io_uri, ec);
+    if (ec) {
+        m_wheel->cancel(m_connect_timer);
+        m_connect_timer = 0;
+        SOCKETIO_LOG(log_error, log_handshake, "Get Connection Error: " << ec.message());
+        connection_lost();
+        return;
+    }
+
+    // The websocket opening handshake gets what is left of the connect deadline.
+    m_wheel->cancel(m_connect_timer);
+    m_connect_timer = 0;
+    long remaining = long(std::chrono::duration_cast<std::chrono::milliseconds>(m_connect_deadline - timing_wheel::clock::now()).count());
+    con->set_open_handshake_timeout(remaining > 1 ? remaining : 1);
+
+    // Grab a handle for this connection so we can talk to it in a thread
+    // safe manor after the event loop starts.
+    m_con = con->get_handle();
+
+    // Queue the connection.
+    m_client.connect(con);
+}
 
 void socketio_client_handler::run_loop(const std::string & uri)
 {
+    // The io_service is stopped if an earlier run loop ended; let it run again.
+    m_client.reset();
+    start_connect(uri);
     try
     {
-        std::string io_uri = this->perform_handshake(uri);
-        
-        
-        if(io_uri.size() == 0)
-        {
-            if(m_con_listener)m_con_listener->on_fail(m_con);//where to kill the thread?
-            return;
-        }
-        lib::error_code ec;
-        client_type::connection_ptr con = m_client.get_connection(io_uri, ec);
-        if (ec) {
-            m_client.get_alog().write(websocketpp::log::alevel::app,
-                                      "Get Connection Error: "+ec.message());
-            return;
-        }
-        
-        // Grab a handle for this connection so we can talk to it in a thread
-        // safe manor after the event loop starts.
-        m_con = con->get_handle();
-        
-        // Queue the connection. No DNS queries or network connections will be
-        // made until the io_service event loop is run.
-        m_client.connect(con);
         m_client.run();
-        m_client.get_alog().write(websocketpp::log::alevel::devel,
-                                  "run loop end");
+        SOCKETIO_LOG(log_debug, log_connection, "run loop end");
     }
     catch(std::exception const& e)
     {
-        std::cout<<"connect fail:"<<e.what()<<std::endl;
+        SOCKETIO_LOG(log_error, log_handshake, "connect fail:" << e.what());
     }
 }
 
 
 void socketio_client_handler::ack(int msg_id,std::string const& ack_reponse)
 {
-   std::stringstream package;
-   package << type_ack << ":"<<msg_id<<"::"<<ack_reponse;
+   std::string packet;
+   m_encoder.encode(packet, type_ack, "", ack_reponse, msg_id);
+   send_packet(std::move(packet));
+}
+
+unsigned int socketio_client_handler::register_ack(std::function<void (void)> const& ack, boost::posix_time::time_duration const& timeout,
+   std::function<void (void)> const& on_timeout, std::string const& name)
+{
+   timing_wheel::clock::time_point deadline = timing_wheel::clock::now() + std::chrono::milliseconds(timeout.total_milliseconds());
+
+   // Map nodes never move, so the slot can point at the histogram; only the first ack for a
+   // name allocates.
+   latency_histogram* histogram;
+   {
+      std::lock_guard<std::mutex> lock(m_latency_mutex);
+      histogram = &m_ack_latency[name];
+   }
+   bool evicted = false;
+   unsigned int id = m_acks.add(ack, on_timeout, histogram, &evicted);
+
+   // The wheel and the counters belong to the io thread; put the deadline on it from there.
+   m_client.get_io_service().dispatch([this, id, deadline, evicted]() {
+      if (evicted) count(counter_acks_evicted);
+      timing_wheel::timer_id timer = m_wheel->schedule_at(deadline, [this, id]() {
+         m_acks.timeout(id);
+      });
+      if (!m_acks.set_timer(id, timer)) m_wheel->cancel(timer);
+   });
+   return id;
+}
+
+void socketio_client_handler::cancel_timers(bool keep_held_acks)
+{
+   do_stop_heartbeat();
+   timing_wheel::timer_id* timers[] = { &m_disconnect_timer, &m_connect_timer, &m_reconnect_timer, &m_pressure_timer, &m_batch_timer };
+   for (std::size_t i = 0; i < sizeof(timers) / sizeof(timers[0]); ++i)
+   {
+      m_wheel->cancel(*timers[i]);
+      *timers[i] = 0;
+   }
+   cancel_acks(keep_held_acks);
+}
 
-   send(package.str());
+void socketio_client_handler::cancel_acks(bool keep_held)
+{
+   std::vector<unsigned int> held;
+   if (keep_held)
+   {
+      packet_view packet;
+      for (std::size_t i = 0; i < m_replay.size(); ++i)
+      {
+         if (parse_packet(m_replay[i].data(), m_replay[i].size(), packet) && packet.id != 0) held.push_back(packet.id);
+      }
+      std::sort(held.begin(), held.end());
+   }
+   std::vector<ack_registry::timer_id> timers;
+   m_acks.cancel_all(&timers, &held);
+   for (std::size_t i = 0; i < timers.size(); ++i)
+   {
+      m_wheel->cancel(timers[i]);
+   }
 }
 
 void socketio_client_handler::on_socketio_proxy(int msg_id,std::function<void(std::string* ack_response)> func)
@@ -642,49 +1464,192 @@ void socketio_client_handler::set_connection_listener(socketio::socketio_client_
 
 void socketio_client_handler::set_socketio_listener(socketio::socketio_client_handler::socketio_listener *listener)
 {
-    m_io_listener = listener;
+    m_routes.listener = listener;
+}
+
+void socketio_client_handler::on(const std::string& name, const event_handler& handler)
+{
+   m_routes.handlers.insert(name, handler);
+}
+
+void socketio_client_handler::on(const std::string& name, event_stream_listener* listener)
+{
+   m_routes.streams.insert(name, listener);
+}
+
+void socketio_client_handler::off(const std::string& name)
+{
+   m_routes.handlers.erase(name);
+   m_routes.streams.erase(name);
+}
+
+socketio_namespace& socketio_client_handler::of(const std::string& endpoint)
+{
+   socketio_namespace** found = m_namespace_index.find(endpoint.data(), endpoint.size());
+   if (found) return **found;
+   m_namespaces.push_back(std::shared_ptr<socketio_namespace>(new socketio_namespace(*this, endpoint, m_namespaces.size())));
+   m_namespace_index.insert(endpoint, m_namespaces.back().get());
+   return *m_namespaces.back();
 }
 
 // This is where you'd add in behavior to handle the message data for your own app.
-void socketio_client_handler::on_socketio_message(int msgId, const std::string& msgEndpoint,const std::string& data)
+void socketio_client_handler::on_socketio_message(int msgId, const std::string& msgEndpoint,const std::string& data, socketio_namespace* ns)
 {
+   socketio_listener* listener = listener_for(ns);
    this->on_socketio_proxy(msgId,[&](std::string* ack_response){
-      if(m_io_listener)m_io_listener->on_socketio_message(msgEndpoint,data,ack_response);
+      if(listener)listener->on_socketio_message(msgEndpoint,data,ack_response);
    });
 }
 
 // This is where you'd add in behavior to handle json messages.
-void socketio_client_handler::on_socketio_json(int msgId,const std::string& msgEndpoint, Document& json)
+void socketio_client_handler::on_socketio_json(int msgId,const std::string& msgEndpoint, Document& json, socketio_namespace* ns)
 {
+   socketio_listener* listener = listener_for(ns);
    this->on_socketio_proxy(msgId,[&](std::string* ack_response){
-      if(m_io_listener)m_io_listener->on_socketio_json(msgEndpoint,json,ack_response);
+      if(listener)listener->on_socketio_json(msgEndpoint,json,ack_response);
    });
 }
 
 // This is where you'd add in behavior to handle events.
 // By default, nothing is done with the endpoint or ID params.
-void socketio_client_handler::on_socketio_event(int msgId,const std::string& msgEndpoint,const std::string& name, const Value& args)
+void socketio_client_handler::on_socketio_event(int msgId,const std::string& msgEndpoint,const Value& name, const Value& args, socketio_namespace* ns)
 {
+   // Registered handlers win; the name is hashed straight out of the parsed JSON.
+   event_handler* handler = find_handler(ns, name.GetString(), name.GetStringLength(), hash_name(name.GetString(), name.GetStringLength()));
+   if (handler)
+   {
+      this->on_socketio_proxy(msgId,[&](std::string* ack_response){
+         (*handler)(msgEndpoint,args,ack_response);
+      });
+      return;
+   }
+
+   socketio_listener* listener = listener_for(ns);
+   if (!listener)
+   {
+      // Nobody is interested, but the server still expects its ack.
+      if (msgId > 0) this->ack(msgId, std::string());
+      return;
+   }
+
+   std::string event_name(name.GetString(), name.GetStringLength());
    this->on_socketio_proxy(msgId,[&](std::string* ack_response){
-      if(m_io_listener)m_io_listener->on_socketio_event(msgEndpoint,name,args,ack_response);
+      listener->on_socketio_event(msgEndpoint,event_name,args,ack_response);
    });
 }
 
 // This is where you'd add in behavior to handle ack
-void socketio_client_handler::on_socketio_ack(const std::string& data)
+void socketio_client_handler::on_socketio_ack(boost::string_ref data)
 {
-   unsigned int id = atoi(data.c_str());
+   unsigned int id = 0;
+   parse_uint(data.data(), data.data() + data.size(), id);
    
-   auto it = m_acks.find(id);
-   if(it!=m_acks.end())
+   // Unknown ids are acks that already timed out (or were never ours).
+   ack_registry::timer_id timer = 0;
+   ack_registry::round_trip rtt;
+   if (!m_acks.complete(id, &timer, &rtt)) return;
+   if (timer) m_wheel->cancel(timer);
+   if (rtt.histogram)
    {
-      (it->second)();
-      m_acks.erase(it);
+      std::lock_guard<std::mutex> lock(m_latency_mutex);
+      rtt.histogram->record(std::chrono::duration_cast<std::chrono::microseconds>(rtt.elapsed).count());
    }
 }
 
+socketio::latency_histogram socketio_client_handler::ack_latency(const std::string& name) const
+{
+   std::lock_guard<std::mutex> lock(m_latency_mutex);
+   std::map<std::string, latency_histogram>::const_iterator it = m_ack_latency.find(name);
+   return it == m_ack_latency.end() ? latency_histogram() : it->second;
+}
+
+std::map<std::string, socketio::latency_histogram> socketio_client_handler::ack_latencies() const
+{
+   std::lock_guard<std::mutex> lock(m_latency_mutex);
+   return m_ack_latency;
+}
+
 // This is where you'd add in behavior to handle errors
-void socketio_client_handler::on_socketio_error(const std::string& endpoint,const std::string& reason,const std::string& advice)
+void socketio_client_handler::on_socketio_error(const std::string& endpoint,const std::string& reason,const std::string& advice, socketio_namespace* ns)
+{
+   socketio_listener* listener = listener_for(ns);
+   if(listener)listener->on_socketio_error(endpoint,reason,advice);
+}
+socketio_namespace::socketio_namespace(socketio_client_handler& handler, const std::string& name, std::size_t id) :
+   m_handler(handler),
+   m_name(name),
+   m_id(id),
+   m_prefixes(name)
+{
+}
+
+void socketio_namespace::connect()
+{
+   m_handler.connect_endpoint(m_name);
+}
+
+void socketio_namespace::disconnect()
+{
+   m_handler.disconnect_endpoint(m_name);
+}
+
+void socketio_namespace::on(const std::string& name, const event_handler& handler)
+{
+   m_routes.handlers.insert(name, handler);
+}
+
+void socketio_namespace::on(const std::string& name, event_stream_listener* listener)
+{
+   m_routes.streams.insert(name, listener);
+}
+
+void socketio_namespace::off(const std::string& name)
+{
+   m_routes.handlers.erase(name);
+   m_routes.streams.erase(name);
+}
+
+void socketio_namespace::emit(std::string const& name, Document& args)
+{
+   std::string packet;
+   m_handler.m_encoder.encode_event(packet, m_prefixes, name, args, 0);
+   m_handler.send_packet(std::move(packet));
+}
+
+void socketio_namespace::emit(std::string const& name, Document& args, std::function<void (void)> ack)
+{
+   unsigned int id = m_handler.register_ack(ack, m_handler.m_ack_timeout, std::function<void (void)>(), name);
+   std::string packet;
+   m_handler.m_encoder.encode_event(packet, m_prefixes, name, args, id);
+   m_handler.send_packet(std::move(packet));
+}
+
+void socketio_namespace::message(const std::string& msg)
+{
+   std::string packet;
+   m_handler.m_encoder.encode(packet, type_message, m_prefixes, msg, 0);
+   m_handler.send_packet(std::move(packet));
+}
+
+void socketio_namespace::message(const std::string& msg, std::function<void (void)> const& ack)
 {
-   if(m_io_listener)m_io_listener->on_socketio_error(endpoint,reason,advice);
-}
\ No newline at end of file
+   unsigned int id = m_handler.register_ack(ack, m_handler.m_ack_timeout, std::function<void (void)>(), "message");
+   std::string packet;
+   m_handler.m_encoder.encode(packet, type_message, m_prefixes, msg, id);
+   m_handler.send_packet(std::move(packet));
+}
+
+void socketio_namespace::json_message(Document& json)
+{
+   std::string packet;
+   m_handler.m_encoder.encode_json(packet, type_json, m_prefixes, json, 0);
+   m_handler.send_packet(std::move(packet));
+}
+
+void socketio_namespace::json_message(Document& json, std::function<void (void)> const& ack)
+{
+   unsigned int id = m_handler.register_ack(ack, m_handler.m_ack_timeout, std::function<void (void)>(), "json");
+   std::string packet;
+   m_handler.m_encoder.encode_json(packet, type_json, m_prefixes, json, id);
+   m_handler.send_packet(std::move(packet));
+}
@@ -27,9 +27,31 @@
 #include <websocketpp/client.hpp>
 #include <websocketpp/config/asio_no_tls_client.hpp>
 
+#include "socket_io_client_pool.hpp"
+#include "socket_io_send_queue.hpp"
+#include "socket_io_packet.hpp"
+#include "socket_io_json.hpp"
+#include "socket_io_dispatch.hpp"
+#include "socket_io_event_stream.hpp"
+#include "socket_io_ack.hpp"
+#include "socket_io_http.hpp"
+#include "socket_io_resolver.hpp"
+#include "socket_io_log.hpp"
+#include "socket_io_metrics.hpp"
+#include "socket_io_recorder.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
 #include <string>
 #include <queue>
+#include <vector>
 
 #define JSON_BUFFER_SIZE 20000
 
@@ -40,57 +62,40 @@ using namespace rapidjson;
 
 namespace socketio {
 
-   enum packet_type
-   {
-      type_disconnect = 0,
-      type_connect = 1,
-      type_heartbeat = 2,
-      type_message = 3,
-      type_json = 4,
-      type_event = 5,
-      type_ack = 6,
-      type_error = 7,
-      type_noop = 8
-   };
-
-
    typedef client<config::asio_client> client_type;
 
+   class socketio_namespace;
+
    class socketio_client_handler {
    public:
-      socketio_client_handler() : m_heartbeatActive(false),
-         m_connected(false),
-         m_con_listener(NULL),
-         m_io_listener(NULL),
-         m_heartbeatTimeout(0),
-         m_network_thread(NULL)
-      {
-            // m_client.clear_access_channels(websocketpp::log::alevel::all);
-            // m_client.set_access_channels(websocketpp::log::alevel::connect);
-            // m_client.set_access_channels(websocketpp::log::alevel::disconnect);
-            // m_client.set_access_channels(websocketpp::log::alevel::app);
-
-            // // Initialize the Asio transport policy
-            // m_client.init_asio();
-
-            // // Bind the handlers we are using
-            // using websocketpp::lib::placeholders::_1;
-            // using websocketpp::lib::bind;
-            
-            // m_client.set_open_handler(bind(&socketio::socketio_client_handler::on_open,this,::_1));
-            // m_client.set_close_handler(bind(&socketio::socketio_client_handler::on_close,this,::_1));
-            // m_client.set_fail_handler(bind(&socketio::socketio_client_handler::on_fail,this,::_1));
-            // m_client.set_message_handler(bind(&socketio::socketio_client_handler::on_message,this,::_1,::_2));
+      // Standalone handler: connect() spawns a network thread running a private event loop.
+      socketio_client_handler() : socketio_client_handler(static_cast<socketio_client_pool*>(NULL))
+      {
+         init_client(NULL, NULL);
+      };
+
+      // Pooled handler: runs on one of the pool's io_service threads instead of its own.
+      // The pool must outlive the handler.
+      explicit socketio_client_handler(socketio_client_pool& pool) : socketio_client_handler(&pool)
+      {
+         socketio_client_pool::event_loop& loop = pool.next_loop();
+         m_io_thread = loop.thread_id;
+         init_client(&loop.io_service, &loop.wheel);
       };
 
-      ~socketio_client_handler() 
-      {};
+      // A pooled handler that is still connected is closed first (see close()), and
+      // whatever it still has on the pool's loop is cleared, before it goes away.
+      ~socketio_client_handler();
       class connection_listener
       {
          public:
             virtual void on_fail(connection_hdl con) = 0;
             virtual void on_open(connection_hdl con) = 0;
             virtual void on_close(connection_hdl con) = 0;
+            // Outbound data (queued packets plus what websocketpp hasn't written yet) reached
+            // the high watermark, and later fell back to the low watermark.
+            virtual void on_pressure(connection_hdl /*con*/, std::size_t /*buffered*/) {}
+            virtual void on_drain(connection_hdl /*con*/, std::size_t /*buffered*/) {}
             virtual ~connection_listener()
             {}
       };
@@ -111,19 +116,56 @@ namespace socketio {
 
       void set_socketio_listener(socketio_listener *listener);
 
+      // Per-event handler. Receives the endpoint, the event's args and, when the server asked
+      // for an ack, a string to fill with the ack response (NULL otherwise).
+      typedef std::function<void (const std::string& msgEndpoint, const Value& args, std::string* ackResponse)> event_handler;
+
+      // Registers handler for events called name, replacing any previous one. Events with a
+      // registered handler don't reach socketio_listener::on_socketio_event; the rest do if a
+      // listener is set and are dropped otherwise. Register handlers before connect().
+      void on(const std::string& name, const event_handler& handler);
+
+      // Streams the args of events called name into listener as rapidjson Reader callbacks,
+      // with no Document built. The name is found before anything is decoded. A stream
+      // listener takes precedence over a handler registered for the same name. The
+      // listener must outlive its registration.
+      void on(const std::string& name, event_stream_listener* listener);
+
+      // Decodes the first argument of events called name straight into a T, e.g. a struct
+      // declared with SOCKETIO_STRUCT, and passes it to handler:
+      //    on<quote>("quote", [](const std::string& endpoint, const quote& q, std::string* ack) {...});
+      // Registered as a stream listener, so no Document is built. The handler keeps the
+      // listener until it is destroyed.
+      template <typename T>
+      void on(const std::string& name, const typename struct_listener<T>::handler_type& handler)
+      {
+         m_routes.bound.push_back(std::unique_ptr<event_stream_listener>(new struct_listener<T>(handler)));
+         on(name, m_routes.bound.back().get());
+      }
+
+      // Removes the handler or stream listener registered for name.
+      void off(const std::string& name);
+
+      // Returns the namespace object for endpoint, creating it on first use. Packets arriving
+      // on the endpoint are routed to its handlers and listener first; what it doesn't handle
+      // falls through to the handler's own. The object lives as long as the handler. Create
+      // namespaces before connect().
+      socketio_namespace& of(const std::string& endpoint);
+
       // Client Functions - such as send, etc.
 
       // Sends a plain string to the endpoint. No special formatting performed to the string.
+      // Safe to call from any thread: the packet is queued and written by the io thread.
       void send(const std::string &msg);
 
       // Allows user to send a custom socket.IO message
-      void send(unsigned int type, std::string endpoint, std::string msg, unsigned int id = 0);
+      void send(unsigned int type, const std::string& endpoint, const std::string& msg, unsigned int id = 0);
 
       // Signal connection to the desired endpoint. Allows the use of the endpoint once message is successfully sent.
-      void connect_endpoint(std::string endpoint);
+      void connect_endpoint(const std::string& endpoint);
 
       // Signal disconnect from specified endpoint.
-      void disconnect_endpoint(std::string endpoint);
+      void disconnect_endpoint(const std::string& endpoint);
 
       // Emulates the emit function from socketIO (type 5) 
       void emit(std::string const& name, Document& args, std::string const& endpoint = "");
@@ -134,52 +176,391 @@ namespace socketio {
 
       void emit(std::string const& name, std::string const& arg0, std::string const& endpoint, std::function<void (void)> ack);
 
+      // As above, but on_timeout runs instead of ack if the server hasn't acked within timeout
+      // or the connection closes first.
+      void emit(std::string const& name, Document& args, std::string const& endpoint, std::function<void (void)> ack,
+         boost::posix_time::time_duration const& timeout, std::function<void (void)> on_timeout);
+
+      void emit(std::string const& name, std::string const& arg0, std::string const& endpoint, std::function<void (void)> ack,
+         boost::posix_time::time_duration const& timeout, std::function<void (void)> on_timeout);
+
+      // Emits with the arguments serialized straight into the packet, with no Document in
+      // between: emit("trade", socketio::args(42, 1.5, "buy", levels)). See
+      // socket_io_serialize.hpp for the argument types that can be written.
+      template <typename... Ts>
+      void emit(std::string const& name, event_args<Ts...> const& args, std::string const& endpoint = "")
+      {
+         std::string packet;
+         m_encoder.encode_event(packet, endpoint, name, args, 0);
+         send_packet(std::move(packet));
+      }
+
+      template <typename... Ts>
+      void emit(std::string const& name, event_args<Ts...> const& args, std::string const& endpoint, std::function<void (void)> ack)
+      {
+         emit(name, args, endpoint, ack, m_ack_timeout, std::function<void (void)>());
+      }
+
+      template <typename... Ts>
+      void emit(std::string const& name, event_args<Ts...> const& args, std::string const& endpoint, std::function<void (void)> ack,
+         boost::posix_time::time_duration const& timeout, std::function<void (void)> on_timeout)
+      {
+         unsigned int id = register_ack(ack, timeout, on_timeout, name);
+         std::string packet;
+         m_encoder.encode_event(packet, endpoint, name, args, id);
+         send_packet(std::move(packet));
+      }
+
+      // Emits only while buffered_bytes() is below the high watermark. With no wait it fails
+      // fast; otherwise it blocks for up to wait for the buffer to drain. Returns false if the
+      // event was not sent. Never wait on the io thread, e.g. from a listener callback.
+      bool try_emit(std::string const& name, Document& args, std::string const& endpoint = "",
+         boost::posix_time::time_duration const& wait = boost::posix_time::time_duration());
+
+      bool try_emit(std::string const& name, std::string const& arg0, std::string const& endpoint = "",
+         boost::posix_time::time_duration const& wait = boost::posix_time::time_duration());
+
+      template <typename... Ts>
+      bool try_emit(std::string const& name, event_args<Ts...> const& args, std::string const& endpoint = "",
+         boost::posix_time::time_duration const& wait = boost::posix_time::time_duration())
+      {
+         if (!wait_for_room(wait)) return false;
+         emit(name, args, endpoint);
+         return true;
+      }
+
       // Sends a plain message (type 3)
-      void message(std::string msg, std::string endpoint = "");
+      void message(const std::string& msg, const std::string& endpoint = "");
 
-      void message(std::string msg, std::string endpoint, std::function<void (void)>  const& ack);
+      void message(const std::string& msg, const std::string& endpoint, std::function<void (void)>  const& ack);
 
       // Sends a JSON message (type 4)
-      void json_message(Document& json, std::string endpoint = "");
+      void json_message(Document& json, const std::string& endpoint = "");
 
-      void json_message(Document& json, std::string endpoint, std::function<void (void)> const& ack);
+      void json_message(Document& json, const std::string& endpoint, std::function<void (void)> const& ack);
 
       void connect(const std::string& uri);
 
-      // Closes the connection
+      // Closes the connection. On a pooled handler, close() waits until the connection is
+      // gone and the handler has nothing left on the pool's event loop, so the handler can
+      // be destroyed as soon as it returns. Called on the io thread, e.g. from a listener
+      // callback, it only starts closing.
       void close();
 
-      // Heartbeat operations.
+      // Heartbeat operations. Safe to call from any thread.
       void start_heartbeat();
       void stop_heartbeat();
 
       std::string getSid() { return m_sid; }
       std::string getResource() { return m_resource; }
       bool connected() { return m_connected; }
+
+      // Opt-in: parse JSON and event packets in place from a reusable copy of the payload,
+      // reusing the Document's memory across messages. Strings in the Documents and Values
+      // handed to listeners are then only valid for the duration of the callback.
+      // Call before connect().
+      void set_insitu_parsing(bool enabled) { m_insitu_parsing = enabled; }
+
+      // Deadline for acks requested without an explicit timeout. Defaults to 60 seconds.
+      void set_ack_timeout(boost::posix_time::time_duration const& timeout) { m_ack_timeout = timeout; }
+
+      // How many acks may be in flight at once (rounded up to a power of two). Past it the
+      // oldest in the way is given up: its on_timeout runs and the acks_evicted_total metric
+      // counts it. Defaults to 65536.
+      void set_max_pending_acks(std::size_t max) { m_acks.set_max_capacity(max); }
+
+      // Deadline for resolving, connecting and both handshakes. Defaults to 20 seconds.
+      // Call before connect().
+      void set_connect_timeout(boost::posix_time::time_duration const& timeout) { m_connect_timeout = timeout; }
+
+      // Opt-in: send the handshake request as HTTP/1.1 keep-alive and keep the connection open
+      // afterwards, so the next handshake to the same server (a reconnect) skips DNS and the
+      // TCP handshake. A connection the server closed in the meantime is replaced transparently.
+      // close() closes the kept connection. Call before connect().
+      void set_handshake_keep_alive(bool enabled) { m_handshake_keep_alive = enabled; }
+
+      // How long the last successful connect() took, from the start of the handshake until
+      // the websocket opened. Zero until a connection has opened.
+      std::chrono::microseconds time_to_connected() const { return std::chrono::microseconds(m_time_to_connected.load()); }
+
+      // Reconnects automatically after the connection fails or drops, unless close() was
+      // called. Each attempt redoes the handshake, rejoins every endpoint passed to
+      // connect_endpoint() and then sends the packets held back while disconnected.
+      // max_attempts 0 keeps trying forever. Call before connect().
+      void set_reconnect(bool enabled, unsigned int max_attempts = 0) { m_reconnect = enabled; m_reconnect_max_attempts = max_attempts; }
+
+      // Attempt n waits initial * 2^n, capped at max, less a random fraction of up to jitter
+      // (0 to 1). Defaults: 1 second, 30 seconds, 0.5.
+      void set_reconnect_delay(boost::posix_time::time_duration const& initial, boost::posix_time::time_duration const& max, double jitter = 0.5)
+      {
+         m_reconnect_delay = initial;
+         m_reconnect_max_delay = max;
+         m_reconnect_jitter = jitter < 0 ? 0 : (jitter > 1 ? 1 : jitter);
+      }
+
+      // Messages, JSON messages and events sent while disconnected are held, up to limit, and
+      // sent in one batch once connected; past the limit the oldest are dropped. 0 drops them
+      // right away. Connects, heartbeats and acks are never held: connect_endpoint() joins
+      // are resent by the reconnect itself. Defaults to 1024. Call before connect().
+      void set_replay_limit(std::size_t limit) { m_replay_limit = limit; }
+
+      // Successful reconnects, and how long the last one took from losing the connection to
+      // the new one opening.
+      unsigned int reconnects() const { return m_reconnects; }
+      std::chrono::microseconds time_to_recover() const { return std::chrono::microseconds(m_time_to_recover.load()); }
+
+      // Held-back packets dropped because the replay buffer was full.
+      std::size_t replay_dropped() const { return m_replay_dropped; }
+
+      // Number of sent packets still waiting for their ack.
+      std::size_t pending_acks() const { return m_acks.pending(); }
+
+      // Round-trip times in microseconds of acked packets, from the emit call until the
+      // server's ack arrived, by event name. Acked message() and json_message() calls are
+      // listed as "message" and "json". Acks that time out are not recorded. The returned
+      // histograms are copies; merge them to combine handlers.
+      latency_histogram ack_latency(const std::string& name) const;
+      std::map<std::string, latency_histogram> ack_latencies() const;
+
+      // Outbound bytes not yet written to the socket: packets queued or held for replay plus
+      // websocketpp's own write buffer as last seen by the io thread.
+      std::size_t buffered_bytes() const { return m_queued_bytes + m_wire_bytes; }
+
+      // connection_listener::on_pressure fires once buffered_bytes() reaches high, and on_drain
+      // once it is back down to low. Defaults: 1 MiB and 256 KiB. 0 disables the watermarks.
+      void set_watermarks(std::size_t high, std::size_t low) { m_high_watermark = high; m_low_watermark = low < high ? low : high; }
+
+      // Coalesces outbound packets into multi-packet frames of up to max_frame_bytes. With a
+      // max_delay, a frame that isn't full waits that long for more packets before it is
+      // written; without one, each flush writes whatever has queued up. 0 bytes (the default)
+      // sends every packet in its own frame. Call before connect().
+      void set_batching(std::size_t max_frame_bytes, boost::posix_time::time_duration const& max_delay = boost::posix_time::time_duration())
+      {
+         m_batch_bytes_limit = max_frame_bytes;
+         m_batch_delay = max_delay;
+      }
+
+      // Number of packets queued by send() that the io thread hasn't written yet.
+      std::size_t queued_packets() const { return m_send_queue.depth(); }
+
+      // This handler's counters. They are also summed into metrics_registry::instance(), which
+      // renders both in the Prometheus text format.
+      const connection_metrics& metrics() const { return m_metrics; }
+
+      // Names this handler's series in the registry output (connection="label"). Defaults to
+      // a number unique within the process.
+      void set_metrics_label(const std::string& label);
+
+      // Opt-in: appends every frame received and sent to recorder, with a timestamp, for
+      // replaying later (see examples/bench/replay.cpp). NULL stops recording. Call before
+      // connect().
+      void set_recorder(const std::shared_ptr<traffic_recorder>& recorder) { m_recorder = recorder; }
+
+      // Network-free hooks for tests and benchmarks, on a standalone handler that is never
+      // connected. The calling thread then stands in for the io thread.
+      typedef std::function<void (const std::string& frame)> outbound_sink;
+
+      // Hands every outbound frame to sink instead of a websocket; the handler counts as
+      // connected while a sink is set.
+      void set_outbound_sink(const outbound_sink& sink);
+
+      // Handles frame as if the server had sent it.
+      void process_frame(const std::string& frame);
+
+      // Runs the io work that is ready, e.g. writing packets queued by emit(). Returns the
+      // number of handlers run.
+      std::size_t poll();
    private:
+      friend class socketio_namespace;
+
+      // Member defaults, shared by the public constructors.
+      explicit socketio_client_handler(socketio_client_pool* pool);
+
+      // What on(), on<T>() and set_socketio_listener() registered, on the handler or on one
+      // namespace.
+      struct event_routes
+      {
+         event_routes() : listener(NULL)
+         {}
+
+         event_table<event_handler> handlers;
+         event_table<event_stream_listener*> streams;
+         // The listeners on<T>() created.
+         std::vector<std::unique_ptr<event_stream_listener> > bound;
+         socketio_listener* listener;
+      };
+
+      // An in-flight socket.IO handshake. Its async operations hold a reference, so a
+      // handshake abandoned by close() or the deadline stays valid until they return.
+      struct handshake_state
+      {
+         explicit handshake_state(boost::asio::io_service& io_service) : lookup(0),
+            socket(io_service),
+            received(0),
+            reused(false)
+         {}
+
+         // The resolver_cache request until it answers, 0 after.
+         resolver_cache::request_id lookup;
+         // Parallel connect attempts until one of them wins.
+         std::shared_ptr<connect_race> race;
+         boost::asio::ip::tcp::socket socket;
+         std::string host;
+         std::string port;
+         std::string socket_io_resource;
+         std::string request;
+         char buffer[4096];
+         http_response_parser parser;
+         // Response bytes read so far.
+         std::size_t received;
+         // Set when the connection was kept alive from an earlier handshake.
+         bool reused;
+      };
 
       // Performs a socket.IO handshake
       // https://github.com/LearnBoost/socket.io-spec
       // param - url takes a ws:// address with port number
       // param - socketIoResource is the resource where the server is listening. Defaults to "/socket.io".
-      // Returns a socket.IO url for performing the actual connection.
-      std::string perform_handshake(std::string url, std::string socketIoResource = "/socket.io");
+      // Resolves, connects, posts the handshake request and reads the reply asynchronously on the
+      // io thread, then opens the websocket with open_websocket().
+      void start_handshake(const std::string& url, const std::string& socketIoResource = "/socket.io");
+      void resolve_handshake(std::shared_ptr<handshake_state> hs);
+      void handshake_resolved(std::shared_ptr<handshake_state> hs, const boost::system::error_code& ec, const resolver_cache::endpoints& addresses);
+      void handshake_connected(std::shared_ptr<handshake_state> hs, const boost::system::error_code& ec, boost::asio::ip::tcp::socket* socket);
+      void send_handshake_request(std::shared_ptr<handshake_state> hs);
+      void handshake_written(std::shared_ptr<handshake_state> hs, const boost::system::error_code& ec);
+      void handshake_read(std::shared_ptr<handshake_state> hs, const boost::system::error_code& ec, std::size_t bytes);
+      void handshake_failed(std::shared_ptr<handshake_state> hs, const std::string& reason);
+      void handshake_timed_out();
+
+      // Starts over on a new connection after a kept-alive one turned out to be closed.
+      void retry_handshake(std::shared_ptr<handshake_state> hs);
+
+      // Reads the session settings out of the handshake reply. Returns the socket.IO url for
+      // the websocket connection, or an empty string if the server refused.
+      std::string parse_handshake_response(const handshake_state& hs);
+
+      // Queues the websocket connection to io_uri.
+      void open_websocket(const std::string& io_uri);
+
+      // Sets up logging and the asio transport. NULL lets websocketpp create its own io_service,
+      // and the handler then keeps its own timing wheel on it.
+      void init_client(boost::asio::io_service* io_service, timing_wheel* wheel);
+
+      // Starts the handshake on the handler's io_service.
+      void start_connect(const std::string & uri);
 
       void run_loop(const std::string & uri);
 
+      // Queues an encoded packet without copying it.
+      void send_packet(std::string&& packet);
+
+      // Writes every queued outbound packet to the connection, or holds them for replay while
+      // disconnected. Runs on the io thread.
+      void flush_send_queue();
+      void write_packet(const std::string& msg);
+      void hold_packet(std::string& msg);
+      // Holds the batch and the send queue for replay once the connection is gone, then
+      // cancels the timers. Runs on the io thread.
+      void hold_unsent();
+
+      // Writes msg now, or adds it to the batch when batching is on.
+      void send_or_batch(std::string& msg);
+
+      // Writes the batch as one frame (just the packet if there is only one). Runs on the io thread.
+      void write_batch();
+
+      // Compares the buffered bytes with the watermarks, firing on_pressure or on_drain and
+      // waking blocked try_emit callers. Re-checks every wheel tick while under pressure.
+      // Runs on the io thread.
+      void update_pressure();
+
+      // Waits until buffered_bytes() is below the high watermark or wait has passed.
+      bool wait_for_room(boost::posix_time::time_duration const& wait);
+
+      // Sends a connect packet for every endpoint joined with connect_endpoint().
+      void rejoin_endpoints();
+
+      // Schedules the next reconnect attempt, if reconnecting is enabled. Runs on the io thread.
+      void connection_lost();
+
+      // Sends the disconnect packet and closes the connection. Runs on the io thread.
+      void do_close();
+
+      // Wakes a close() waiting for the connection to be gone. Runs on the io thread.
+      void close_done();
+
+      // True on the thread running the handler's io_service.
+      bool on_io_thread() const;
+
+      // Runs f on the io thread and waits for it to return. Never call it on the io thread.
+      void run_on_io_thread(const std::function<void (void)>& f);
+
       // Sends a heartbeat to the server.
       void send_heartbeat();
 
       // Called when the heartbeat timer fires.
       void heartbeat();
 
-      // Parses a socket.IO message received
+      // Heartbeat timer bookkeeping. Run on the io thread.
+      void do_start_heartbeat();
+      void do_stop_heartbeat();
+
+      // Closes the connection if nothing arrived from the server within the disconnect
+      // timeout. Runs on the io thread.
+      void check_disconnect();
+
+      // Parses a socket.IO message received, splitting multi-packet frames.
       void parse_message(const std::string &msg);
 
+      // Handles one packet of a received frame.
+      void handle_packet(boost::string_ref msg);
+
+      // The namespace created with of() for endpoint, or NULL.
+      socketio_namespace* namespace_for(boost::string_ref endpoint);
+
+      // The endpoint as the std::string listeners receive: the namespace's name, or a copy.
+      const std::string& endpoint_name(const packet_view& packet, socketio_namespace* ns);
+
+      // Lookups that try ns (when not NULL) before the handler's own registrations.
+      event_handler* find_handler(socketio_namespace* ns, const char* name, std::size_t length, boost::uint64_t hash);
+      event_stream_listener* find_stream(socketio_namespace* ns, const char* name, std::size_t length, boost::uint64_t hash);
+      socketio_listener* listener_for(socketio_namespace* ns);
+
+      // Routes an event by its name: to a stream listener, to parse_json_packet, or nowhere
+      // when nobody listens.
+      void parse_event_packet(const packet_view& packet, socketio_namespace* ns);
+      void stream_event(const packet_view& packet, socketio_namespace* ns, const event_scan& scan, event_stream_listener& listener);
+
+      // Parses the JSON body of a type 4 or 5 packet and hands it to dispatch_json_packet.
+      void parse_json_packet(const packet_view& packet, socketio_namespace* ns);
+      void dispatch_json_packet(const packet_view& packet, socketio_namespace* ns, Document& json);
+
       void ack(int id, const std::string &ack_response);
 
+      // Reserves an ack id for a packet about to be sent. Its round trip is recorded under name.
+      unsigned int register_ack(std::function<void (void)> const& ack, boost::posix_time::time_duration const& timeout,
+         std::function<void (void)> const& on_timeout, std::string const& name);
+
+      // Cancels every pending ack and its deadline timer, except those of packets held for
+      // replay if keep_held is set. Runs on the io thread.
+      void cancel_acks(bool keep_held = false);
+
+      // Cancels every timer the handler has on the wheel: heartbeat, disconnect check,
+      // connect deadline, reconnect, backpressure re-check, batch flush and the ack
+      // deadlines. The wheel may be shared with other handlers, so nothing of this one
+      // may be left on it once it is closed. keep_held_acks spares the acks of packets held
+      // for replay, which the next connection still carries. Runs on the io thread.
+      void cancel_timers(bool keep_held_acks = false);
+
       void on_socketio_proxy(int msg_id,std::function<void(std::string* ack_response)> func);
 
+      // Adds n to counter c for this connection and the process. Runs on the io thread.
+      void count(metric_counter c, boost::uint64_t n = 1) { metrics_registry::instance().add(c, n, &m_metrics); }
+
+      // Counts an outbound packet by its type.
+      void count_sent(const std::string& packet);
+
       // Callbacks
       void on_fail(connection_hdl con);
       void on_open(connection_hdl con);
@@ -187,13 +568,14 @@ namespace socketio {
       void on_message(connection_hdl con, client_type::message_ptr msg);
 
       // Message Parsing callbacks.
-      void on_socketio_message(int msgId,const std::string& msgEndpoint,const std::string& data);
-      void on_socketio_json(int msgId,const std::string& msgEndpoint, Document& json);
-      void on_socketio_event(int msgId,const std::string& msgEndpoint,const std::string& name, const Value& args);
-      void on_socketio_ack(const std::string& data);
-      void on_socketio_error(const std::string& endppoint,const std::string& reason,const std::string& advice);
-
-      // Connection pointer for client functions.
+      // ns is the namespace the packet arrived on, or NULL.
+      void on_socketio_message(int msgId,const std::string& msgEndpoint,const std::string& data, socketio_namespace* ns);
+      void on_socketio_json(int msgId,const std::string& msgEndpoint, Document& json, socketio_namespace* ns);
+      void on_socketio_event(int msgId,const std::string& msgEndpoint,const Value& name, const Value& args, socketio_namespace* ns);
+      void on_socketio_ack(boost::string_ref data);
+      void on_socketio_error(const std::string& endppoint,const std::string& reason,const std::string& advice, socketio_namespace* ns);
+
+      // Connection pointer for client functions. Only touched on the io thread.
       connection_hdl m_con;
       client_type m_client;
       // Socket.IO server settings
@@ -202,24 +584,209 @@ namespace socketio {
       unsigned int m_disconnectTimeout;
       std::string m_socketIoUri;
       std::string m_resource;
-      bool m_connected;
+      std::atomic<bool> m_connected;
 
       // Currently we assume websocket as the transport, though you can find others in this string
       std::string m_transports;
 
-      std::map<unsigned int, std::function<void (void)> > m_acks;
+      // Reused by parse_message for the fields listeners receive as std::string.
+      std::string m_endpoint_buffer;
+      std::string m_data_buffer;
+      std::string m_advice_buffer;
+
+      // Handlers and listeners registered on the handler itself, and the parser that feeds
+      // stream listeners.
+      event_routes m_routes;
+      event_stream_parser m_stream_parser;
+
+      // Namespaces created with of(); a namespace's id is its index. Inbound endpoints are
+      // looked up by hash, so routing a packet never compares endpoint strings one by one.
+      std::vector<std::shared_ptr<socketio_namespace> > m_namespaces;
+      event_table<socketio_namespace*> m_namespace_index;
+
+      bool m_insitu_parsing;
+      insitu_json_parser m_json_parser;
+
+      // Outbound packets pushed by user threads, drained in batches on the io thread.
+      mpsc_queue<std::string> m_send_queue;
+
+      // Builds outbound packets, caching the header prefixes per endpoint.
+      packet_encoder m_encoder;
+
+      // Packets waiting for a server ack, keyed by this connection's ack ids.
+      ack_registry m_acks;
+      boost::posix_time::time_duration m_ack_timeout;
+
+      // Ack round-trip histograms by event name. Written on the io thread, added to by any
+      // thread that emits with an ack.
+      mutable std::mutex m_latency_mutex;
+      std::map<std::string, latency_histogram> m_ack_latency;
+
+      // The handshake in progress, if any, and the deadline covering it and the websocket opening
+      // handshake. Only touched on the io thread.
+      std::shared_ptr<handshake_state> m_handshake;
+      bool m_handshake_keep_alive;
+      // Connection left open by the last keep-alive handshake, reused by the next one.
+      std::shared_ptr<handshake_state> m_idle_handshake;
+      boost::posix_time::time_duration m_connect_timeout;
+      timing_wheel::timer_id m_connect_timer;
+      timing_wheel::clock::time_point m_connect_deadline;
+      timing_wheel::clock::time_point m_connect_started;
+      std::atomic<long long> m_time_to_connected;
+
+      // Reconnect state. The settings are written before connect(); the rest is only touched
+      // on the io thread.
+      std::string m_uri;
+      bool m_closing;
+      bool m_reconnect;
+      unsigned int m_reconnect_max_attempts;
+      boost::posix_time::time_duration m_reconnect_delay;
+      boost::posix_time::time_duration m_reconnect_max_delay;
+      double m_reconnect_jitter;
+      unsigned int m_reconnect_attempt;
+      timing_wheel::timer_id m_reconnect_timer;
+      timing_wheel::clock::time_point m_connection_lost;
+      std::mt19937 m_rng;
+      std::atomic<unsigned int> m_reconnects;
+      std::atomic<long long> m_time_to_recover;
+
+      // Endpoints to rejoin after a reconnect.
+      std::mutex m_endpoints_mutex;
+      std::set<std::string> m_endpoints;
+
+      // Packets sent while disconnected, oldest first. Only touched on the io thread.
+      std::deque<std::string> m_replay;
+      std::size_t m_replay_limit;
+      std::atomic<std::size_t> m_replay_dropped;
+
+      // Backpressure. The byte counts are written on the io thread (m_queued_bytes also by
+      // send_packet) and read from any thread.
+      std::atomic<std::size_t> m_queued_bytes;
+      std::atomic<std::size_t> m_wire_bytes;
+      std::size_t m_high_watermark;
+      std::size_t m_low_watermark;
+      bool m_pressure;
+      timing_wheel::timer_id m_pressure_timer;
+      std::atomic<int> m_room_waiters;
+      std::mutex m_room_mutex;
+      std::condition_variable m_room_available;
+
+      // Packets waiting to be written as one multi-packet frame. Only touched on the io thread.
+      std::size_t m_batch_bytes_limit;
+      boost::posix_time::time_duration m_batch_delay;
+      std::vector<std::string> m_batch;
+      std::size_t m_batch_bytes;
+      timing_wheel::timer_id m_batch_timer;
+      std::string m_frame_buffer;
+
+      // Receives outbound frames instead of m_con when set.
+      outbound_sink m_outbound_sink;
+
+      // Records the traffic when set.
+      std::shared_ptr<traffic_recorder> m_recorder;
+
+      // Heartbeat, disconnect and ack timers all live on this wheel: the pool thread's shared
+      // wheel, or m_own_wheel for a standalone handler. Only touched on the io thread.
+      timing_wheel* m_wheel;
+      std::unique_ptr<timing_wheel> m_own_wheel;
+      timing_wheel::timer_id m_heartbeat_timer;
+      timing_wheel::clock::time_point m_heartbeat_due;
+      timing_wheel::timer_id m_disconnect_timer;
+      timing_wheel::clock::time_point m_last_received;
+
+      connection_metrics m_metrics;
 
-      static unsigned int s_global_event_id;
+      lib::thread *m_network_thread;
 
-      // If you're using C++11 use the standar library smart pointer
-      std::unique_ptr<boost::asio::deadline_timer> m_heartbeatTimer;
+      // Pool the handler is attached to, NULL for a standalone handler, and the pool thread
+      // it runs on.
+      socketio_client_pool* m_pool;
+      std::thread::id m_io_thread;
 
-      lib::thread *m_network_thread;
+      // Set by close_done(), which a pooled close() waits for.
+      std::mutex m_close_mutex;
+      std::condition_variable m_close_done;
+      bool m_closed;
 
       bool m_heartbeatActive;
 
       connection_listener* m_con_listener;
-      socketio_listener *m_io_listener;
+   };
+
+   // A handle on one endpoint (socket.IO namespace) of a connection, from
+   // socketio_client_handler::of("/chat"). It holds the endpoint's encoded packet headers,
+   // so sending on it skips the encoder's cache, and its own handlers and listener for
+   // what arrives on the endpoint. Like the handler's, register them before connect().
+   class socketio_namespace {
+   public:
+      typedef socketio_client_handler::event_handler event_handler;
+      typedef socketio_client_handler::socketio_listener socketio_listener;
+
+      const std::string& name() const { return m_name; }
+
+      // Index of the namespace within its handler, in order of creation.
+      std::size_t id() const { return m_id; }
+
+      // Joins and leaves the endpoint, as connect_endpoint() and disconnect_endpoint() do.
+      void connect();
+      void disconnect();
+
+      // As socketio_client_handler's, for events on this endpoint only.
+      void on(const std::string& name, const event_handler& handler);
+      void on(const std::string& name, event_stream_listener* listener);
+
+      template <typename T>
+      void on(const std::string& name, const typename struct_listener<T>::handler_type& handler)
+      {
+         m_routes.bound.push_back(std::unique_ptr<event_stream_listener>(new struct_listener<T>(handler)));
+         on(name, m_routes.bound.back().get());
+      }
+
+      void off(const std::string& name);
+
+      // Receives the messages, JSON messages, events and errors on this endpoint that no
+      // handler took, instead of the handler's socketio_listener.
+      void set_socketio_listener(socketio_listener* listener) { m_routes.listener = listener; }
+
+      // As socketio_client_handler's, sent to this endpoint.
+      void emit(std::string const& name, Document& args);
+      void emit(std::string const& name, Document& args, std::function<void (void)> ack);
+
+      template <typename... Ts>
+      void emit(std::string const& name, event_args<Ts...> const& args)
+      {
+         std::string packet;
+         m_handler.m_encoder.encode_event(packet, m_prefixes, name, args, 0);
+         m_handler.send_packet(std::move(packet));
+      }
+
+      template <typename... Ts>
+      void emit(std::string const& name, event_args<Ts...> const& args, std::function<void (void)> ack)
+      {
+         unsigned int id = m_handler.register_ack(ack, m_handler.m_ack_timeout, std::function<void (void)>(), name);
+         std::string packet;
+         m_handler.m_encoder.encode_event(packet, m_prefixes, name, args, id);
+         m_handler.send_packet(std::move(packet));
+      }
+
+      void message(const std::string& msg);
+      void message(const std::string& msg, std::function<void (void)> const& ack);
+
+      void json_message(Document& json);
+      void json_message(Document& json, std::function<void (void)> const& ack);
+
+   private:
+      friend class socketio_client_handler;
+
+      socketio_namespace(socketio_client_handler& handler, const std::string& name, std::size_t id);
+      socketio_namespace(const socketio_namespace&);
+      socketio_namespace& operator=(const socketio_namespace&);
+
+      socketio_client_handler& m_handler;
+      std::string m_name;
+      std::size_t m_id;
+      packet_prefixes m_prefixes;
+      socketio_client_handler::event_routes m_routes;
    };
 
    typedef client<config::asio_client> socketio_client;
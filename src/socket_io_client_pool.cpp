@@ -0,0 +1,50 @@
+/* socket_io_client_pool.cpp
+* Shared io_service worker pool for socketio_client_handler instances.
+*/
+
+#include "socket_io_client_pool.hpp"
+
+using socketio::socketio_client_pool;
+
+socketio_client_pool::socketio_client_pool(std::size_t thread_count) : m_next(0)
+{
+   if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+   if (thread_count == 0) thread_count = 1;
+
+   m_workers.reserve(thread_count);
+   for (std::size_t i = 0; i < thread_count; ++i)
+   {
+      std::unique_ptr<worker> w(new worker());
+      // Keep run() from returning while no handler has queued any work yet.
+      w->work.reset(new boost::asio::io_service::work(w->loop.io_service));
+      boost::asio::io_service* ios = &w->loop.io_service;
+      w->thread = std::thread([ios]() {
+         ios->run();
+      });
+      w->loop.thread_id = w->thread.get_id();
+      m_workers.push_back(std::move(w));
+   }
+}
+
+socketio_client_pool::~socketio_client_pool()
+{
+   stop();
+}
+
+socketio_client_pool::event_loop& socketio_client_pool::next_loop()
+{
+   std::size_t index = m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+   return m_workers[index]->loop;
+}
+
+void socketio_client_pool::stop()
+{
+   for (std::size_t i = 0; i < m_workers.size(); ++i)
+   {
+      m_workers[i]->work.reset();
+   }
+   for (std::size_t i = 0; i < m_workers.size(); ++i)
+   {
+      if (m_workers[i]->thread.joinable()) m_workers[i]->thread.join();
+   }
+}
@@ -0,0 +1,73 @@
+/* socket_io_client_pool.hpp
+* Shared io_service worker pool for socketio_client_handler instances.
+*
+* Every handler normally owns a network thread and an event loop. A pool owns
+* a fixed number of io_service threads instead, and handlers constructed with
+* a pool are spread across them round robin. Each thread also has one timing
+* wheel that holds the heartbeat, disconnect and ack timers of its sessions.
+*/
+
+#ifndef __SOCKET_IO_CLIENT_POOL_HPP__
+#define __SOCKET_IO_CLIENT_POOL_HPP__
+
+#include <boost/asio.hpp>
+
+#include "socket_io_timer_wheel.hpp"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace socketio {
+
+   class socketio_client_pool {
+   public:
+      // Starts thread_count io_service threads. 0 uses one thread per hardware core.
+      explicit socketio_client_pool(std::size_t thread_count = 0);
+
+      // Stops the event loops and joins the worker threads.
+      ~socketio_client_pool();
+
+      // An io_service thread's event loop and the timing wheel its sessions share.
+      struct event_loop
+      {
+         event_loop() : wheel(io_service)
+         {}
+
+         boost::asio::io_service io_service;
+         timing_wheel wheel;
+         // The worker thread running io_service.
+         std::thread::id thread_id;
+      };
+
+      // Returns the event loop the next attached handler should run on.
+      event_loop& next_loop();
+
+      boost::asio::io_service& next_io_service() { return next_loop().io_service; }
+
+      // Number of worker threads (and io_services) owned by the pool.
+      std::size_t size() const { return m_workers.size(); }
+
+      // Lets the event loops run out of work and joins the worker threads.
+      // Handlers attached to the pool must be closed first.
+      void stop();
+
+   private:
+      socketio_client_pool(const socketio_client_pool&);
+      socketio_client_pool& operator=(const socketio_client_pool&);
+
+      struct worker
+      {
+         event_loop loop;
+         std::unique_ptr<boost::asio::io_service::work> work;
+         std::thread thread;
+      };
+
+      std::vector<std::unique_ptr<worker> > m_workers;
+      std::atomic<std::size_t> m_next;
+   };
+
+}
+
+#endif // __SOCKET_IO_CLIENT_POOL_HPP__
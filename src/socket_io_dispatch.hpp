@@ -0,0 +1,168 @@
+/* socket_io_dispatch.hpp
+* Event name lookup for per-event handler registration.
+*
+* event_table is an open addressing hash table keyed by the 64-bit FNV-1a hash of
+* the event name. Names are hashed once on registration; lookups hash the bytes
+* straight out of the parsed JSON string, so dispatching an event never builds a
+* std::string. A small bloom filter over the registered hashes sits in front of the
+* table, so a name nobody subscribed to usually costs one hash and one bit test.
+* The handler keys its namespaces by endpoint in the same kind of table.
+*/
+
+#ifndef __SOCKET_IO_DISPATCH_HPP__
+#define __SOCKET_IO_DISPATCH_HPP__
+
+#include <boost/cstdint.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace socketio {
+
+   // 64-bit FNV-1a.
+   inline boost::uint64_t hash_name(const char* name, std::size_t length)
+   {
+      boost::uint64_t h = 14695981039346656037ULL;
+      for (std::size_t i = 0; i < length; ++i)
+      {
+         h ^= (unsigned char)name[i];
+         h *= 1099511628211ULL;
+      }
+      return h;
+   }
+
+   // hash_name of a string literal, computed by the compiler.
+   constexpr boost::uint64_t hash_literal(const char* name, boost::uint64_t h = 14695981039346656037ULL)
+   {
+      return *name ? hash_literal(name + 1, (h ^ (unsigned char)*name) * 1099511628211ULL) : h;
+   }
+
+   template <typename Handler>
+   class event_table {
+   public:
+      event_table() : m_size(0), m_live(0)
+      {}
+
+      // Registers (or replaces) the handler for name.
+      void insert(const std::string& name, const Handler& handler)
+      {
+         if ((m_size + 1) * 2 > m_slots.size()) grow();
+         boost::uint64_t h = hash_name(name.data(), name.size());
+         add_to_filter(h);
+         slot* s = probe(h, name.data(), name.size());
+         if (!s->used)
+         {
+            s->used = true;
+            s->hash = h;
+            s->name = name;
+            ++m_size;
+         }
+         if (!s->handler && handler) ++m_live;
+         else if (s->handler && !handler) --m_live;
+         s->handler = handler;
+      }
+
+      // Removes the handler for name. The slot is kept as a tombstone so probe chains stay
+      // intact, and the filter keeps its bits until the next grow; a removed name just costs
+      // a probe again.
+      void erase(const std::string& name)
+      {
+         Handler* h = find(name.data(), name.size());
+         if (!h) return;
+         *h = Handler();
+         --m_live;
+      }
+
+      // Returns the handler registered for name, or NULL when nobody subscribed to it.
+      Handler* find(const char* name, std::size_t length)
+      {
+         return find(name, length, hash_name(name, length));
+      }
+
+      Handler* find(const char* name, std::size_t length, boost::uint64_t hash)
+      {
+         if (m_live == 0 || !might_contain(hash)) return NULL;
+         slot* s = probe(hash, name, length);
+         return s->used && s->handler ? &s->handler : NULL;
+      }
+
+      // False when no name with this hash was ever registered; true may be a false positive.
+      bool might_contain(boost::uint64_t hash) const
+      {
+         if (m_filter.empty()) return false;
+         std::size_t mask = m_filter.size() * 64 - 1;
+         std::size_t a = std::size_t(hash) & mask;
+         std::size_t b = std::size_t(hash >> 32) & mask;
+         return (m_filter[a / 64] >> (a % 64) & 1) && (m_filter[b / 64] >> (b % 64) & 1);
+      }
+
+      // Names with a handler; removed ones don't count.
+      bool empty() const { return m_live == 0; }
+      std::size_t size() const { return m_live; }
+
+   private:
+      struct slot
+      {
+         slot() : used(false), hash(0), handler()
+         {}
+
+         bool used;
+         boost::uint64_t hash;
+         std::string name;
+         Handler handler;
+      };
+
+      // Linear probing over used slots, tombstones included; returns the matching slot or the empty slot where name would go.
+      slot* probe(boost::uint64_t hash, const char* name, std::size_t length)
+      {
+         std::size_t mask = m_slots.size() - 1;
+         for (std::size_t i = std::size_t(hash) & mask; ; i = (i + 1) & mask)
+         {
+            slot& s = m_slots[i];
+            if (!s.used) return &s;
+            if (s.hash == hash && s.name.size() == length && std::memcmp(s.name.data(), name, length) == 0) return &s;
+         }
+      }
+
+      // Two bits per name out of 16 bits per slot, i.e. at least 32 bits per registered
+      // name: about 1% false positives.
+      void add_to_filter(boost::uint64_t hash)
+      {
+         std::size_t mask = m_filter.size() * 64 - 1;
+         std::size_t a = std::size_t(hash) & mask;
+         std::size_t b = std::size_t(hash >> 32) & mask;
+         m_filter[a / 64] |= boost::uint64_t(1) << (a % 64);
+         m_filter[b / 64] |= boost::uint64_t(1) << (b % 64);
+      }
+
+      // Rehashes into a table twice the size, leaving the tombstones behind.
+      void grow()
+      {
+         std::vector<slot> old;
+         old.swap(m_slots);
+         m_slots.resize(old.empty() ? 16 : old.size() * 2);
+         m_filter.assign(m_slots.size() / 4, 0);
+         m_size = 0;
+         for (std::size_t i = 0; i < old.size(); ++i)
+         {
+            if (!old[i].used || !old[i].handler) continue;
+            slot* s = probe(old[i].hash, old[i].name.data(), old[i].name.size());
+            s->used = true;
+            s->hash = old[i].hash;
+            s->name.swap(old[i].name);
+            s->handler = old[i].handler;
+            add_to_filter(old[i].hash);
+            ++m_size;
+         }
+      }
+
+      std::vector<slot> m_slots;
+      std::vector<boost::uint64_t> m_filter;
+      std::size_t m_size;     // used slots, tombstones included
+      std::size_t m_live;     // slots with a handler
+   };
+
+}
+
+#endif // __SOCKET_IO_DISPATCH_HPP__
@@ -0,0 +1,427 @@
+/* socket_io_event_stream.hpp
+* Streaming delivery of event arguments, without a DOM.
+*
+* peek_event_name() reads the name of an event body that starts with it, as socket.io
+* writes them, without looking at the rest. scan_event() walks the whole top level of
+* an event's {"name":...,"args":[...]} body without parsing it: it returns a view of
+* the name and the byte range of the args array. Either way the event is routed
+* before anything is decoded. event_stream_parser
+* then runs a rapidjson Reader over just the args range, in situ on a reused copy, and
+* the Reader's callbacks go straight to an event_stream_listener. A consumer that
+* only sums two numbers out of each event never builds a Document and doesn't
+* allocate.
+*
+* struct_listener<T> is such a listener that decodes the first argument straight
+* into a T (see json::bind), for socketio_client_handler::on<T>().
+*/
+
+#ifndef __SOCKET_IO_EVENT_STREAM_HPP__
+#define __SOCKET_IO_EVENT_STREAM_HPP__
+
+#include <rapidjson/reader.h>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include "socket_io_dispatch.hpp"
+#include "socket_io_log.hpp"
+#include "socket_io_serialize.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace socketio {
+
+   // Receives the args array of one event as rapidjson Reader callbacks: StartArray for
+   // args itself, then every value in it, then EndArray. Override the callbacks you need;
+   // the rest do nothing. Register with socketio_client_handler::on(name, listener).
+   class event_stream_listener
+   {
+   public:
+      typedef char Ch;
+
+      virtual ~event_stream_listener()
+      {}
+
+      // Called before the args of an event are streamed.
+      virtual void begin_event(const std::string& /*endpoint*/) {}
+      // Called once all of args has been streamed. ack_response is non-NULL when the server
+      // asked for an ack; whatever it holds on return is sent back as the ack's data.
+      virtual void end_event(std::string* /*ack_response*/) {}
+      // Called instead of end_event when args turned out to be malformed part way through;
+      // anything gathered since begin_event should be dropped.
+      virtual void abort_event() {}
+
+      // rapidjson's Handler concept. Strings passed to String() stay valid until end_event.
+      virtual void Null() {}
+      virtual void Bool(bool /*b*/) {}
+      virtual void Int(int /*i*/) {}
+      virtual void Uint(unsigned /*i*/) {}
+      virtual void Int64(boost::int64_t /*i*/) {}
+      virtual void Uint64(boost::uint64_t /*i*/) {}
+      virtual void Double(double /*d*/) {}
+      virtual void String(const Ch* /*str*/, rapidjson::SizeType /*length*/, bool /*copy*/) {}
+      virtual void StartObject() {}
+      virtual void EndObject(rapidjson::SizeType /*memberCount*/) {}
+      virtual void StartArray() {}
+      virtual void EndArray(rapidjson::SizeType /*elementCount*/) {}
+   };
+
+   // The routing fields of an event body, as views into it.
+   struct event_scan
+   {
+      event_scan() : args_begin(NULL), args_end(NULL)
+      {}
+
+      boost::string_ref name;
+      const char* args_begin;     // NULL when the event has no args member
+      const char* args_end;
+   };
+
+   namespace detail {
+
+      inline const char* skip_whitespace(const char* p, const char* end)
+      {
+         while (p != end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) ++p;
+         return p;
+      }
+
+      // p is at an opening quote. Returns the position after the closing quote, or NULL if
+      // the string isn't terminated. escaped is set when the string holds a backslash.
+      inline const char* skip_string(const char* p, const char* end, bool& escaped)
+      {
+         escaped = false;
+         for (++p; p != end; ++p)
+         {
+            if (*p == '"') return p + 1;
+            if (*p == '\\')
+            {
+               escaped = true;
+               if (++p == end) return NULL;
+            }
+         }
+         return NULL;
+      }
+
+      // Returns the position after the JSON value starting at p, or NULL if it is cut short.
+      // Only brackets and strings are looked at; the Reader validates the rest later.
+      inline const char* skip_value(const char* p, const char* end)
+      {
+         if (p == end) return NULL;
+         bool escaped;
+         if (*p == '"') return skip_string(p, end, escaped);
+         if (*p == '{' || *p == '[')
+         {
+            int depth = 0;
+            while (p != end)
+            {
+               char c = *p;
+               if (c == '"')
+               {
+                  p = skip_string(p, end, escaped);
+                  if (!p) return NULL;
+                  continue;
+               }
+               if (c == '{' || c == '[') ++depth;
+               else if ((c == '}' || c == ']') && --depth == 0) return p + 1;
+               ++p;
+            }
+            return NULL;
+         }
+         const char* begin = p;
+         while (p != end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t') ++p;
+         return p != begin ? p : NULL;
+      }
+
+   }
+
+   // Reads the name of an event body whose first member is "name", without looking any
+   // further. Returns false when the body starts differently or the name holds escapes.
+   inline bool peek_event_name(const char* data, std::size_t length, boost::string_ref& name)
+   {
+      const char* end = data + length;
+      const char* p = detail::skip_whitespace(data, end);
+      if (p == end || *p != '{') return false;
+      p = detail::skip_whitespace(p + 1, end);
+      if (std::size_t(end - p) < 6 || std::memcmp(p, "\"name\"", 6) != 0) return false;
+      p = detail::skip_whitespace(p + 6, end);
+      if (p == end || *p != ':') return false;
+      p = detail::skip_whitespace(p + 1, end);
+      if (p == end || *p != '"') return false;
+      bool escaped;
+      const char* name_end = detail::skip_string(p, end, escaped);
+      if (!name_end || escaped) return false;
+      name = boost::string_ref(p + 1, std::size_t(name_end - p - 2));
+      return true;
+   }
+
+   // Finds the name and the args range of an event body without decoding it. Returns false
+   // when the body isn't a well formed object, has no string name, or the name or a key
+   // holds escapes; the caller then falls back to a full parse.
+   inline bool scan_event(const char* data, std::size_t length, event_scan& out)
+   {
+      const char* end = data + length;
+      const char* p = detail::skip_whitespace(data, end);
+      if (p == end || *p != '{') return false;
+      p = detail::skip_whitespace(p + 1, end);
+      if (p != end && *p == '}') return false;
+
+      out = event_scan();
+      bool have_name = false;
+      for (;;)
+      {
+         if (p == end || *p != '"') return false;
+         bool escaped;
+         const char* key_end = detail::skip_string(p, end, escaped);
+         if (!key_end || escaped) return false;
+         boost::string_ref key(p + 1, std::size_t(key_end - p - 2));
+
+         p = detail::skip_whitespace(key_end, end);
+         if (p == end || *p != ':') return false;
+         p = detail::skip_whitespace(p + 1, end);
+
+         const char* value = p;
+         p = detail::skip_value(p, end);
+         if (!p) return false;
+         if (key == "name")
+         {
+            if (*value != '"') return false;
+            detail::skip_string(value, end, escaped);
+            if (escaped) return false;
+            out.name = boost::string_ref(value + 1, std::size_t(p - value - 2));
+            have_name = true;
+         }
+         else if (key == "args")
+         {
+            out.args_begin = value;
+            out.args_end = p;
+         }
+
+         p = detail::skip_whitespace(p, end);
+         if (p == end) return false;
+         if (*p == '}') return have_name;
+         if (*p != ',') return false;
+         p = detail::skip_whitespace(p + 1, end);
+      }
+   }
+
+   // Streams args ranges into listeners. The range is copied into a buffer kept between
+   // events, so it can be parsed in situ: strings are unescaped in place instead of being
+   // copied out one by one.
+   class event_stream_parser {
+   public:
+      // Streams the JSON in [begin, end), which must be an array or an object. Returns false
+      // if it is malformed; the listener may have seen part of it by then.
+      bool parse(const char* begin, const char* end, event_stream_listener& listener)
+      {
+         m_text.assign(begin, end);
+         m_text.push_back('\0');
+         rapidjson::InsituStringStream stream(&m_text[0]);
+         return m_reader.Parse<rapidjson::kParseInsituFlag>(stream, listener);
+      }
+
+      const char* error() const { return m_reader.GetParseError(); }
+
+   private:
+      std::vector<char> m_text;
+      rapidjson::Reader m_reader;
+   };
+
+   // Stores the reader callbacks for an args array into the target bound to its first
+   // element. Values with nowhere to go, such as unknown keys, whole subtrees under them,
+   // values of the wrong type and the remaining args, are skipped.
+   class value_reader {
+   public:
+      value_reader() : m_bound(false), m_at_root(false)
+      {}
+
+      void reset(const json::value_target& root)
+      {
+         m_root = root;
+         m_bound = false;
+         m_stack.clear();
+      }
+
+      // Whether the first argument had the shape of the root's type.
+      bool bound() const { return m_bound; }
+
+      void value_bool(bool b)
+      {
+         json::value_target t = begin_value();
+         if (t.binder && t.binder->set_bool) mark(t).binder->set_bool(t.object, b);
+      }
+
+      void value_int(boost::int64_t i)
+      {
+         json::value_target t = begin_value();
+         if (t.binder && t.binder->set_int) mark(t).binder->set_int(t.object, i);
+      }
+
+      void value_uint(boost::uint64_t i)
+      {
+         json::value_target t = begin_value();
+         if (t.binder && t.binder->set_uint) mark(t).binder->set_uint(t.object, i);
+      }
+
+      void value_double(double d)
+      {
+         json::value_target t = begin_value();
+         if (t.binder && t.binder->set_double) mark(t).binder->set_double(t.object, d);
+      }
+
+      void value_null()
+      {
+         begin_value();
+      }
+
+      void string(const char* str, std::size_t length)
+      {
+         if (!m_stack.empty() && m_stack.back().kind == frame_object && m_stack.back().expect_key)
+         {
+            frame& f = m_stack.back();
+            f.expect_key = false;
+            f.pending = json::value_target();
+            if (f.target.binder && f.target.binder->member)
+            {
+               f.target.binder->member(f.target.object, hash_name(str, length), str, length, f.pending);
+            }
+            return;
+         }
+         json::value_target t = begin_value();
+         if (t.binder && t.binder->set_string) mark(t).binder->set_string(t.object, str, length);
+      }
+
+      void start_object()
+      {
+         json::value_target t = begin_value();
+         if (t.binder && t.binder->member) mark(t);
+         else t = json::value_target();
+         m_stack.push_back(frame(frame_object, t));
+      }
+
+      void start_array()
+      {
+         if (m_stack.empty())
+         {
+            m_stack.push_back(frame(frame_args, json::value_target()));
+            return;
+         }
+         json::value_target t = begin_value();
+         if (t.binder && t.binder->element) mark(t);
+         else t = json::value_target();
+         m_stack.push_back(frame(frame_array, t));
+      }
+
+      void end_container()
+      {
+         if (!m_stack.empty()) m_stack.pop_back();
+      }
+
+   private:
+      enum frame_kind
+      {
+         frame_args,
+         frame_object,
+         frame_array
+      };
+
+      struct frame
+      {
+         frame(frame_kind k, const json::value_target& t) : kind(k), target(t), expect_key(true), index(0)
+         {}
+
+         frame_kind kind;
+         json::value_target target;   // no binder: skipped
+         json::value_target pending;  // objects: the member the next value goes to
+         bool expect_key;             // objects: the next string is a key
+         std::size_t index;           // args: elements seen
+      };
+
+      // The target of the value that is about to start, in the innermost container.
+      json::value_target begin_value()
+      {
+         m_at_root = false;
+         if (m_stack.empty()) return json::value_target();
+         frame& f = m_stack.back();
+         switch (f.kind)
+         {
+         case frame_object:
+            f.expect_key = true;
+            return f.pending;
+         case frame_array:
+            return f.target.binder ? f.target.binder->element(f.target.object) : json::value_target();
+         case frame_args:
+            m_at_root = f.index++ == 0;
+            return m_at_root ? m_root : json::value_target();
+         }
+         return json::value_target();
+      }
+
+      // Notes that the first argument matched the root's type.
+      const json::value_target& mark(const json::value_target& t)
+      {
+         if (m_at_root) m_bound = true;
+         return t;
+      }
+
+      json::value_target m_root;
+      bool m_bound;
+      bool m_at_root;
+      std::vector<frame> m_stack;
+   };
+
+   // Decodes the first argument of each event into a T and hands it to a handler. T is
+   // anything json::bind takes: a struct declared with SOCKETIO_STRUCT, a number, a string
+   // or a vector of those. Keys T doesn't declare are skipped. Members left out of the
+   // event keep the value they have in a default constructed T.
+   template <typename T>
+   class struct_listener : public event_stream_listener
+   {
+   public:
+      typedef std::function<void (const std::string& endpoint, const T& value, std::string* ackResponse)> handler_type;
+
+      explicit struct_listener(const handler_type& handler) : m_handler(handler), m_endpoint(NULL)
+      {}
+
+      void begin_event(const std::string& endpoint)
+      {
+         m_endpoint = &endpoint;
+         m_value = T();
+         m_reader.reset(json::bind(m_value));
+      }
+
+      void end_event(std::string* ack_response)
+      {
+         if (!m_reader.bound())
+         {
+            SOCKETIO_LOG(log_warn, log_packet, "Event args don't match the bound type");
+            return;
+         }
+         m_handler(*m_endpoint, m_value, ack_response);
+      }
+
+      void Null() { m_reader.value_null(); }
+      void Bool(bool b) { m_reader.value_bool(b); }
+      void Int(int i) { m_reader.value_int(i); }
+      void Uint(unsigned i) { m_reader.value_uint(i); }
+      void Int64(boost::int64_t i) { m_reader.value_int(i); }
+      void Uint64(boost::uint64_t i) { m_reader.value_uint(i); }
+      void Double(double d) { m_reader.value_double(d); }
+      void String(const Ch* str, rapidjson::SizeType length, bool) { m_reader.string(str, length); }
+      void StartObject() { m_reader.start_object(); }
+      void EndObject(rapidjson::SizeType) { m_reader.end_container(); }
+      void StartArray() { m_reader.start_array(); }
+      void EndArray(rapidjson::SizeType) { m_reader.end_container(); }
+
+   private:
+      handler_type m_handler;
+      const std::string* m_endpoint;
+      T m_value;
+      value_reader m_reader;
+   };
+
+}
+
+#endif // __SOCKET_IO_EVENT_STREAM_HPP__
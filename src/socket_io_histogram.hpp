@@ -0,0 +1,135 @@
+/* socket_io_histogram.hpp
+* Log-linear latency histogram in the style of HdrHistogram.
+*
+* Values are split into power-of-two ranges, each divided into 64 linear
+* sub-buckets, so every recorded value is kept to within 1/64 (1.6%) of itself
+* from 1 microsecond up to 2^40 (about 12 days). Recording is an index
+* computation and an increment; histograms with the same layout merge by adding
+* their counts, so per-connection histograms can be combined into fleet-wide ones.
+*/
+
+#ifndef __SOCKET_IO_HISTOGRAM_HPP__
+#define __SOCKET_IO_HISTOGRAM_HPP__
+
+#include <boost/cstdint.hpp>
+
+#include <vector>
+
+namespace socketio {
+
+   class latency_histogram {
+   public:
+      // Bits of linear resolution within each power of two.
+      static const int sub_bucket_bits = 6;
+      static const int sub_bucket_count = 1 << sub_bucket_bits;
+      // Largest power of two tracked; larger values are counted as the largest bucket.
+      static const int max_bits = 40;
+      static const int bucket_count = (max_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+      latency_histogram() : m_count(0), m_min(0), m_max(0), m_sum(0)
+      {}
+
+      // Counts value (in whatever unit the caller uses; the handler records microseconds).
+      void record(boost::uint64_t value)
+      {
+         // The buckets are allocated on the first sample so unused histograms stay small.
+         if (m_counts.empty()) m_counts.resize(bucket_count);
+         ++m_counts[index_of(value)];
+         if (m_count == 0 || value < m_min) m_min = value;
+         if (value > m_max) m_max = value;
+         ++m_count;
+         m_sum += value;
+      }
+
+      // Adds other's samples to this histogram.
+      void merge(const latency_histogram& other)
+      {
+         if (other.m_count == 0) return;
+         if (m_counts.empty()) m_counts.resize(bucket_count);
+         for (int i = 0; i < bucket_count; ++i) m_counts[i] += other.m_counts[i];
+         if (m_count == 0 || other.m_min < m_min) m_min = other.m_min;
+         if (other.m_max > m_max) m_max = other.m_max;
+         m_count += other.m_count;
+         m_sum += other.m_sum;
+      }
+
+      void reset()
+      {
+         m_counts.clear();
+         m_count = 0;
+         m_min = 0;
+         m_max = 0;
+         m_sum = 0;
+      }
+
+      boost::uint64_t count() const { return m_count; }
+      boost::uint64_t min() const { return m_min; }
+      boost::uint64_t max() const { return m_max; }
+      double mean() const { return m_count ? double(m_sum) / double(m_count) : 0; }
+
+      // The value at quantile q (0 to 1): the highest value equivalent to the bucket holding
+      // the q * count()th sample, capped at max(). 0 when empty.
+      boost::uint64_t percentile(double q) const
+      {
+         if (m_count == 0) return 0;
+         if (q <= 0) return m_min;
+         boost::uint64_t rank = boost::uint64_t(q * double(m_count) + 0.5);
+         if (rank < 1) rank = 1;
+         if (rank > m_count) rank = m_count;
+         boost::uint64_t seen = 0;
+         for (int i = 0; i < bucket_count; ++i)
+         {
+            seen += m_counts[i];
+            if (seen >= rank)
+            {
+               boost::uint64_t high = highest_equivalent(i);
+               return high < m_max ? high : m_max;
+            }
+         }
+         return m_max;
+      }
+
+      boost::uint64_t p50() const { return percentile(0.5); }
+      boost::uint64_t p99() const { return percentile(0.99); }
+      boost::uint64_t p999() const { return percentile(0.999); }
+
+   private:
+      // Index of the highest set bit; value is never 0 here.
+      static int msb(boost::uint64_t value)
+      {
+#if defined(__GNUC__)
+         return 63 - __builtin_clzll(value);
+#else
+         int bit = 0;
+         while (value >>= 1) ++bit;
+         return bit;
+#endif
+      }
+
+      static int index_of(boost::uint64_t value)
+      {
+         if (value < boost::uint64_t(sub_bucket_count)) return int(value);
+         int bit = msb(value);
+         if (bit >= max_bits) return bucket_count - 1;
+         int shift = bit - sub_bucket_bits;
+         return (shift + 1) * sub_bucket_count + int(value >> shift) - sub_bucket_count;
+      }
+
+      static boost::uint64_t highest_equivalent(int index)
+      {
+         if (index < sub_bucket_count) return boost::uint64_t(index);
+         int shift = index / sub_bucket_count - 1;
+         boost::uint64_t low = boost::uint64_t(index % sub_bucket_count + sub_bucket_count) << shift;
+         return low + (boost::uint64_t(1) << shift) - 1;
+      }
+
+      std::vector<boost::uint64_t> m_counts;
+      boost::uint64_t m_count;
+      boost::uint64_t m_min;
+      boost::uint64_t m_max;
+      boost::uint64_t m_sum;
+   };
+
+}
+
+#endif // __SOCKET_IO_HISTOGRAM_HPP__
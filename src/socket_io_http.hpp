@@ -0,0 +1,310 @@
+/* socket_io_http.hpp
+* Incremental HTTP/1.x response parser for the socket.IO handshake.
+*
+* Bytes are fed in as they come off the socket, in chunks of any size. The parser
+* keeps only the current line and the body, so the handshake never waits for a
+* delimiter that may not come (the old read_until(socket, response, "\0")). Bodies
+* delimited by Content-Length, chunked transfer coding, or the end of the
+* connection are all supported. Lines, the number of headers and the body are
+* capped, so a broken or hostile server can't make the client allocate without
+* bound; a response over a cap fails.
+*/
+
+#ifndef __SOCKET_IO_HTTP_HPP__
+#define __SOCKET_IO_HTTP_HPP__
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace socketio {
+
+   struct http_response
+   {
+      http_response() : major(0), minor(0), status(0)
+      {}
+
+      // Value of the first header called name (case insensitive), or NULL.
+      const std::string* header(const char* name) const
+      {
+         std::size_t length = std::strlen(name);
+         for (std::size_t i = 0; i < headers.size(); ++i)
+         {
+            const std::string& key = headers[i].first;
+            if (key.size() != length) continue;
+            std::size_t j = 0;
+            while (j < length && std::tolower((unsigned char)key[j]) == std::tolower((unsigned char)name[j])) ++j;
+            if (j == length) return &headers[i].second;
+         }
+         return NULL;
+      }
+
+      // True when the server will keep the connection open after this response.
+      bool keep_alive() const
+      {
+         const std::string* connection = header("Connection");
+         bool close = connection && token_in(*connection, "close");
+         bool keep = connection && token_in(*connection, "keep-alive");
+         if (major == 1 && minor >= 1) return !close;
+         return keep;
+      }
+
+      int major;
+      int minor;
+      unsigned int status;
+      std::string reason;
+      std::vector<std::pair<std::string, std::string> > headers;
+      std::string body;
+
+   private:
+      static bool token_in(const std::string& value, const char* token)
+      {
+         std::string lower(value);
+         for (std::size_t i = 0; i < lower.size(); ++i) lower[i] = char(std::tolower((unsigned char)lower[i]));
+         return lower.find(token) != std::string::npos;
+      }
+   };
+
+   class http_response_parser {
+   public:
+      enum result { incomplete, complete, error };
+
+      http_response_parser()
+      {
+         reset();
+      }
+
+      // Starts over for the next response on the same connection.
+      void reset()
+      {
+         m_state = state_status;
+         m_line.clear();
+         m_remaining = 0;
+         m_error = NULL;
+         m_response = http_response();
+      }
+
+      // Consumes up to length bytes. Returns complete once a whole response was read; bytes
+      // after its end are left unconsumed and their count stored in unused if given.
+      result feed(const char* data, std::size_t length, std::size_t* unused = NULL)
+      {
+         const char* p = data;
+         const char* end = data + length;
+         while (p < end && m_state != state_done && m_state != state_error)
+         {
+            switch (m_state)
+            {
+            case state_body_length:
+            case state_chunk_data:
+               {
+                  // The whole length was checked against max_body up front.
+                  std::size_t n = std::size_t(end - p) < m_remaining ? std::size_t(end - p) : m_remaining;
+                  m_response.body.append(p, n);
+                  p += n;
+                  m_remaining -= n;
+                  if (m_remaining == 0) m_state = m_state == state_body_length ? state_done : state_chunk_end;
+               }
+               break;
+            case state_body_eof:
+               if (std::size_t(end - p) > max_body - m_response.body.size())
+               {
+                  fail("body too large");
+                  break;
+               }
+               m_response.body.append(p, end);
+               p = end;
+               break;
+            default:
+               {
+                  const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                  if (!nl)
+                  {
+                     m_line.append(p, end);
+                     p = end;
+                     if (m_line.size() > max_line) fail("line too long");
+                     break;
+                  }
+                  m_line.append(p, nl);
+                  p = nl + 1;
+                  if (m_line.size() > max_line)
+                  {
+                     fail("line too long");
+                     break;
+                  }
+                  if (!m_line.empty() && m_line[m_line.size() - 1] == '\r') m_line.resize(m_line.size() - 1);
+                  on_line();
+                  m_line.clear();
+               }
+               break;
+            }
+         }
+         if (unused) *unused = std::size_t(end - p);
+         return status();
+      }
+
+      // Tells the parser the server closed the connection.
+      result finish()
+      {
+         if (m_state == state_body_eof) m_state = state_done;
+         else if (m_state != state_done && m_state != state_error) fail("connection closed mid-response");
+         return status();
+      }
+
+      result status() const
+      {
+         if (m_state == state_done) return complete;
+         if (m_state == state_error) return error;
+         return incomplete;
+      }
+
+      // Why the response was rejected, once feed or finish returned error.
+      const char* error_message() const { return m_error ? m_error : ""; }
+
+      const http_response& response() const { return m_response; }
+      http_response& response() { return m_response; }
+
+   private:
+      enum state {
+         state_status,
+         state_headers,
+         state_body_length,
+         state_body_eof,
+         state_chunk_size,
+         state_chunk_data,
+         state_chunk_end,
+         state_trailers,
+         state_done,
+         state_error
+      };
+
+      static const std::size_t max_line = 8192;
+      static const std::size_t max_headers = 100;
+      // A handshake body is a short line of session parameters.
+      static const std::size_t max_body = 64 * 1024;
+
+      void fail(const char* message)
+      {
+         m_state = state_error;
+         m_error = message;
+      }
+
+      void on_line()
+      {
+         switch (m_state)
+         {
+         case state_status:
+            parse_status();
+            break;
+         case state_headers:
+            if (m_line.empty()) start_body();
+            else parse_header();
+            break;
+         case state_chunk_size:
+            {
+               char* last = NULL;
+               unsigned long size = std::strtoul(m_line.c_str(), &last, 16);
+               if (last == m_line.c_str()) { fail("bad chunk size"); break; }
+               if (size > max_body - m_response.body.size()) { fail("body too large"); break; }
+               m_remaining = size;
+               m_state = size == 0 ? state_trailers : state_chunk_data;
+            }
+            break;
+         case state_chunk_end:
+            if (!m_line.empty()) fail("missing CRLF after chunk");
+            else m_state = state_chunk_size;
+            break;
+         case state_trailers:
+            if (m_line.empty()) m_state = state_done;
+            break;
+         default:
+            break;
+         }
+      }
+
+      // HTTP/1.1 200 OK
+      void parse_status()
+      {
+         const char* s = m_line.c_str();
+         if (std::strncmp(s, "HTTP/", 5) != 0 || !std::isdigit((unsigned char)s[5]) || s[6] != '.' || !std::isdigit((unsigned char)s[7]))
+         {
+            fail("invalid HTTP status line");
+            return;
+         }
+         m_response.major = s[5] - '0';
+         m_response.minor = s[7] - '0';
+         const char* p = s + 8;
+         while (*p == ' ') ++p;
+         unsigned int status = 0;
+         int digits = 0;
+         for (; std::isdigit((unsigned char)*p); ++p, ++digits) status = status * 10 + (*p - '0');
+         if (digits != 3)
+         {
+            fail("invalid HTTP status code");
+            return;
+         }
+         while (*p == ' ') ++p;
+         m_response.status = status;
+         m_response.reason.assign(p);
+         m_state = state_headers;
+      }
+
+      void parse_header()
+      {
+         if (m_response.headers.size() >= max_headers)
+         {
+            fail("too many headers");
+            return;
+         }
+         std::size_t colon = m_line.find(':');
+         if (colon == std::string::npos || colon == 0)
+         {
+            fail("malformed header");
+            return;
+         }
+         std::size_t begin = colon + 1;
+         std::size_t end = m_line.size();
+         while (begin < end && (m_line[begin] == ' ' || m_line[begin] == '\t')) ++begin;
+         while (end > begin && (m_line[end - 1] == ' ' || m_line[end - 1] == '\t')) --end;
+         m_response.headers.push_back(std::make_pair(m_line.substr(0, colon), m_line.substr(begin, end - begin)));
+      }
+
+      void start_body()
+      {
+         // 1xx, 204 and 304 responses never carry a body.
+         if (m_response.status / 100 == 1 || m_response.status == 204 || m_response.status == 304)
+         {
+            m_state = state_done;
+            return;
+         }
+         const std::string* encoding = m_response.header("Transfer-Encoding");
+         if (encoding && encoding->find("chunked") != std::string::npos)
+         {
+            m_state = state_chunk_size;
+            return;
+         }
+         const std::string* length = m_response.header("Content-Length");
+         if (length)
+         {
+            char* last = NULL;
+            m_remaining = std::strtoul(length->c_str(), &last, 10);
+            if (last == length->c_str()) fail("bad Content-Length");
+            else if (m_remaining > max_body) fail("body too large");
+            else m_state = m_remaining == 0 ? state_done : state_body_length;
+            return;
+         }
+         m_state = state_body_eof;
+      }
+
+      state m_state;
+      std::string m_line;
+      std::size_t m_remaining;
+      const char* m_error;
+      http_response m_response;
+   };
+
+}
+
+#endif // __SOCKET_IO_HTTP_HPP__
@@ -0,0 +1,136 @@
+/* socket_io_json.hpp
+* Reusable in-situ JSON parsing for incoming packets.
+*
+* insitu_json_parser copies each payload into a buffer it owns and parses it with
+* kParseInsituFlag, so strings in the resulting Document point into that buffer
+* instead of being copied. The Document's allocator runs on a memory block that is
+* kept between messages and simply reset, so a steady stream of similar payloads
+* parses without touching the heap.
+*
+* range_stream lets rapidjson read a payload that isn't zero terminated, such as a
+* packet inside a multi-packet frame, without copying it.
+*/
+
+#ifndef __SOCKET_IO_JSON_HPP__
+#define __SOCKET_IO_JSON_HPP__
+
+#include <rapidjson/document.h>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace socketio {
+
+   // Read-only rapidjson stream over [begin, end). Reads '\0' past the end, which is
+   // where a zero terminated string would stop the parser.
+   class range_stream {
+   public:
+      typedef char Ch;
+
+      range_stream(const char* begin, const char* end) : m_position(begin), m_begin(begin), m_end(end)
+      {}
+
+      Ch Peek() const { return m_position != m_end ? *m_position : '\0'; }
+      Ch Take() { return m_position != m_end ? *m_position++ : '\0'; }
+      std::size_t Tell() const { return std::size_t(m_position - m_begin); }
+
+      // Not an output stream.
+      Ch* PutBegin() { RAPIDJSON_ASSERT(false); return 0; }
+      void Put(Ch) { RAPIDJSON_ASSERT(false); }
+      std::size_t PutEnd(Ch*) { RAPIDJSON_ASSERT(false); return 0; }
+
+   private:
+      const char* m_position;
+      const char* m_begin;
+      const char* m_end;
+   };
+
+   class insitu_json_parser {
+   public:
+      typedef rapidjson::MemoryPoolAllocator<> allocator_type;
+      typedef rapidjson::Document document_type;
+
+      // initial_pool is the size of the allocator block; it grows to fit the largest
+      // document seen, up to max_pool.
+      explicit insitu_json_parser(std::size_t initial_pool = 16 * 1024, std::size_t max_pool = 16 * 1024 * 1024) :
+         m_pool_size(initial_pool),
+         m_max_pool(max_pool),
+         m_constructed(false)
+      {}
+
+      ~insitu_json_parser()
+      {
+         destroy();
+      }
+
+      // Parses a copy of [data, data + length). The Document, and every string in it,
+      // stays valid until the next call to parse(). Check HasParseError() on the result.
+      document_type& parse(const char* data, std::size_t length)
+      {
+         reset();
+
+         m_text.assign(data, data + length);
+         m_text.push_back('\0');
+
+         return document().ParseInsitu<0>(&m_text[0]);
+      }
+
+      // Bytes the last document needed from the allocator.
+      std::size_t last_size()
+      {
+         return m_constructed ? allocator().Size() : 0;
+      }
+
+   private:
+      insitu_json_parser(const insitu_json_parser&);
+      insitu_json_parser& operator=(const insitu_json_parser&);
+
+      allocator_type& allocator() { return *reinterpret_cast<allocator_type*>(&m_allocator_storage); }
+      document_type& document() { return *reinterpret_cast<document_type*>(&m_document_storage); }
+
+      // Rebuilds the allocator and Document on the pool block. If the last document
+      // spilled into extra chunks, the block is grown first so the next one won't.
+      void reset()
+      {
+         std::size_t needed = m_pool_size;
+         if (m_constructed)
+         {
+            std::size_t capacity = allocator().Capacity();
+            while (needed < capacity && needed < m_max_pool) needed *= 2;
+         }
+         destroy();
+
+         std::size_t elements = (needed + sizeof(double) - 1) / sizeof(double);
+         if (m_pool.size() < elements) m_pool.resize(elements);
+         m_pool_size = m_pool.size() * sizeof(double);
+
+         new (&m_allocator_storage) allocator_type(reinterpret_cast<char*>(&m_pool[0]), m_pool_size);
+         new (&m_document_storage) document_type(&allocator());
+         m_constructed = true;
+      }
+
+      void destroy()
+      {
+         if (!m_constructed) return;
+         document().~document_type();
+         // Frees any chunks allocated past the pool block; the block itself is kept.
+         allocator().~allocator_type();
+         m_constructed = false;
+      }
+
+      std::vector<char> m_text;
+      // double elements keep the allocator's chunk header aligned.
+      std::vector<double> m_pool;
+      std::size_t m_pool_size;
+      std::size_t m_max_pool;
+      bool m_constructed;
+
+      std::aligned_storage<sizeof(allocator_type), std::alignment_of<allocator_type>::value>::type m_allocator_storage;
+      std::aligned_storage<sizeof(document_type), std::alignment_of<document_type>::value>::type m_document_storage;
+   };
+
+}
+
+#endif // __SOCKET_IO_JSON_HPP__
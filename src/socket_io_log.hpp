@@ -0,0 +1,319 @@
+/* socket_io_log.hpp
+* Logging for the handler's hot paths.
+*
+* SOCKETIO_LOG(level, channel, a << b << c) compiles to nothing when level is below
+* SOCKETIO_LOG_LEVEL, and evaluates its arguments only when the level is enabled at
+* run time and the channel's sampler lets the record through. Records are formatted
+* into a fixed-size slot of a lock-free ring buffer; a background thread drains the
+* ring and hands each line to the sink, so logging never blocks on stdout. The thread
+* sleeps while the ring is empty, and only the record that finds it asleep wakes it.
+* When the ring is full the record is dropped and counted.
+*/
+
+#ifndef __SOCKET_IO_LOG_HPP__
+#define __SOCKET_IO_LOG_HPP__
+
+#include <boost/utility/string_ref.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Lowest level compiled in: 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 none.
+#ifndef SOCKETIO_LOG_LEVEL
+#define SOCKETIO_LOG_LEVEL 2
+#endif
+
+namespace socketio {
+
+   enum log_level
+   {
+      log_trace = 0,
+      log_debug = 1,
+      log_info = 2,
+      log_warn = 3,
+      log_error = 4
+   };
+
+   enum log_channel
+   {
+      log_handshake = 0,   // handshake and connect
+      log_connection = 1,  // open, close, reconnect, heartbeats
+      log_packet = 2,      // every packet sent or received
+      log_channel_count = 3
+   };
+
+   class async_logger {
+   public:
+      // Receives every record on the background thread. The text is not NUL terminated.
+      typedef std::function<void (log_level level, log_channel channel, const char* text, std::size_t length)> sink;
+
+      static const std::size_t record_size = 256;
+
+      static async_logger& instance()
+      {
+         static async_logger logger;
+         return logger;
+      }
+
+      // Records below level are skipped at run time (levels below SOCKETIO_LOG_LEVEL are not
+      // even compiled in).
+      void set_level(log_level level) { m_level = level; }
+
+      // Keeps 1 in every records of channel below log_warn. 1 (the default) keeps them all.
+      void set_sampling(log_channel channel, unsigned int every) { m_sample_every[channel] = every ? every : 1; }
+
+      // Replaces the sink. The default writes warnings and errors to std::cerr, the rest to std::cout.
+      void set_sink(const sink& s)
+      {
+         std::lock_guard<std::mutex> lock(m_sink_mutex);
+         m_sink = s;
+      }
+
+      bool should_log(log_level level, log_channel channel)
+      {
+         if (level < m_level.load(std::memory_order_relaxed)) return false;
+         if (level >= log_warn) return true;
+         unsigned int every = m_sample_every[channel].load(std::memory_order_relaxed);
+         return every <= 1 || m_sample_count[channel].fetch_add(1, std::memory_order_relaxed) % every == 0;
+      }
+
+      // Copies a formatted record into the ring. Returns false (and counts a drop) when full.
+      bool push(log_level level, log_channel channel, const char* text, std::size_t length)
+      {
+         std::size_t pos = m_enqueue.load(std::memory_order_relaxed);
+         cell* c;
+         for (;;)
+         {
+            c = &m_cells[pos & m_mask];
+            std::size_t seq = c->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+            if (diff == 0)
+            {
+               if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0)
+            {
+               m_dropped.fetch_add(1, std::memory_order_relaxed);
+               return false;
+            }
+            else pos = m_enqueue.load(std::memory_order_relaxed);
+         }
+         c->level = level;
+         c->channel = channel;
+         c->length = length < record_size ? length : record_size;
+         std::memcpy(c->text, text, c->length);
+         c->sequence.store(pos + 1, std::memory_order_release);
+
+         // Pairs with the fence in run(): either the consumer sees this record before it
+         // sleeps, or this sees it asleep.
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if (m_sleeping.load(std::memory_order_relaxed) && m_sleeping.exchange(false)) wake();
+         return true;
+      }
+
+      // Records dropped because the ring was full.
+      std::size_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+      // Waits until every record pushed so far has reached the sink.
+      void flush()
+      {
+         std::size_t target = m_enqueue.load(std::memory_order_acquire);
+         while (m_dequeue.load(std::memory_order_acquire) < target)
+         {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+         }
+      }
+
+   private:
+      struct cell
+      {
+         std::atomic<std::size_t> sequence;
+         log_level level;
+         log_channel channel;
+         std::size_t length;
+         char text[record_size];
+      };
+
+      explicit async_logger(std::size_t capacity = 4096) :
+         m_cells(capacity),
+         m_mask(capacity - 1),
+         m_enqueue(0),
+         m_dequeue(0),
+         m_level(log_level(SOCKETIO_LOG_LEVEL)),
+         m_dropped(0),
+         m_sleeping(false),
+         m_running(true)
+      {
+         for (std::size_t i = 0; i < capacity; ++i) m_cells[i].sequence.store(i, std::memory_order_relaxed);
+         for (int i = 0; i < log_channel_count; ++i)
+         {
+            m_sample_every[i] = 1;
+            m_sample_count[i] = 0;
+         }
+         m_sink = [](log_level level, log_channel, const char* text, std::size_t length) {
+            std::ostream& out = level >= log_warn ? std::cerr : std::cout;
+            out.write(text, std::streamsize(length));
+            out << '\n';
+         };
+         m_thread = std::thread([this]() { run(); });
+      }
+
+      ~async_logger()
+      {
+         m_running = false;
+         m_sleeping = false;
+         wake();
+         m_thread.join();
+         drain();
+      }
+
+      async_logger(const async_logger&);
+      async_logger& operator=(const async_logger&);
+
+      void run()
+      {
+         while (m_running.load(std::memory_order_relaxed))
+         {
+            if (drain() > 0) continue;
+
+            // Empty: sleep until a producer finds m_sleeping set. A record pushed before the
+            // flag was visible didn't signal, so look at the ring once more first.
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ready() || !m_running.load(std::memory_order_relaxed))
+            {
+               m_sleeping = false;
+               continue;
+            }
+            m_wake.wait(lock, [this]() { return !m_sleeping.load(); });
+         }
+      }
+
+      void wake()
+      {
+         std::lock_guard<std::mutex> lock(m_wake_mutex);
+         m_wake.notify_one();
+      }
+
+      // True when the next record is ready for the consumer.
+      bool ready() const
+      {
+         std::size_t pos = m_dequeue.load(std::memory_order_relaxed);
+         return m_cells[pos & m_mask].sequence.load(std::memory_order_acquire) == pos + 1;
+      }
+
+      // Single consumer: hands every ready record to the sink.
+      std::size_t drain()
+      {
+         std::size_t count = 0;
+         std::lock_guard<std::mutex> lock(m_sink_mutex);
+         for (;;)
+         {
+            std::size_t pos = m_dequeue.load(std::memory_order_relaxed);
+            cell& c = m_cells[pos & m_mask];
+            if (c.sequence.load(std::memory_order_acquire) != pos + 1) return count;
+            if (m_sink) m_sink(c.level, c.channel, c.text, c.length);
+            c.sequence.store(pos + m_mask + 1, std::memory_order_release);
+            m_dequeue.store(pos + 1, std::memory_order_release);
+            ++count;
+         }
+      }
+
+      std::vector<cell> m_cells;
+      std::size_t m_mask;
+      std::atomic<std::size_t> m_enqueue;
+      std::atomic<std::size_t> m_dequeue;
+
+      std::atomic<int> m_level;
+      std::atomic<unsigned int> m_sample_every[log_channel_count];
+      std::atomic<unsigned int> m_sample_count[log_channel_count];
+      std::atomic<std::size_t> m_dropped;
+
+      std::mutex m_sink_mutex;
+      sink m_sink;
+      // Set by the consumer before it sleeps on m_wake; cleared by whoever wakes it.
+      std::mutex m_wake_mutex;
+      std::condition_variable m_wake;
+      std::atomic<bool> m_sleeping;
+      std::atomic<bool> m_running;
+      std::thread m_thread;
+   };
+
+   // Formats one record on the stack and pushes it to the ring when it goes out of scope.
+   // Output past async_logger::record_size is cut off.
+   class log_stream {
+   public:
+      log_stream(log_level level, log_channel channel) : m_level(level), m_channel(channel), m_length(0)
+      {}
+
+      ~log_stream()
+      {
+         async_logger::instance().push(m_level, m_channel, m_text, m_length);
+      }
+
+      log_stream& operator<<(const char* s) { return append(s, std::strlen(s)); }
+      log_stream& operator<<(const std::string& s) { return append(s.data(), s.size()); }
+      log_stream& operator<<(boost::string_ref s) { return append(s.data(), s.size()); }
+      log_stream& operator<<(char c) { return append(&c, 1); }
+
+      log_stream& operator<<(double v)
+      {
+         char buffer[32];
+         int n = std::snprintf(buffer, sizeof(buffer), "%g", v);
+         return append(buffer, n > 0 ? std::size_t(n) : 0);
+      }
+
+      template <typename T>
+      typename std::enable_if<std::is_integral<T>::value, log_stream&>::type operator<<(T v)
+      {
+         char buffer[24];
+         int n = std::is_signed<T>::value
+            ? std::snprintf(buffer, sizeof(buffer), "%lld", (long long)v)
+            : std::snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)v);
+         return append(buffer, n > 0 ? std::size_t(n) : 0);
+      }
+
+   private:
+      log_stream(const log_stream&);
+      log_stream& operator=(const log_stream&);
+
+      log_stream& append(const char* s, std::size_t length)
+      {
+         std::size_t room = async_logger::record_size - m_length;
+         if (length > room) length = room;
+         std::memcpy(m_text + m_length, s, length);
+         m_length += length;
+         return *this;
+      }
+
+      log_level m_level;
+      log_channel m_channel;
+      std::size_t m_length;
+      char m_text[async_logger::record_size];
+   };
+
+}
+
+// Logs "a << b << ..." at level on channel. Costs nothing when the level is compiled out
+// and only a level check (plus the sampler) when it is disabled at run time.
+#define SOCKETIO_LOG(level, channel, expr) \
+   do { \
+      if ((level) >= SOCKETIO_LOG_LEVEL && ::socketio::async_logger::instance().should_log((level), (channel))) \
+      { \
+         ::socketio::log_stream socketio_log_stream_((level), (channel)); \
+         socketio_log_stream_ << expr; \
+      } \
+   } while (0)
+
+#endif // __SOCKET_IO_LOG_HPP__
@@ -0,0 +1,361 @@
+/* socket_io_metrics.hpp
+* Counters and gauges for socket.IO connections, rendered in the Prometheus text
+* exposition format.
+*
+* Aggregate counters are kept per thread: every thread that records gets its own
+* cache-line aligned slab, written only by that thread, so io threads never share a
+* cache line. Reading sums the slabs (plus whatever threads that have exited left
+* behind). Each handler also keeps its own connection_metrics, written on its io
+* thread; gauges such as pending acks are sampled from the handler when read.
+*/
+
+#ifndef __SOCKET_IO_METRICS_HPP__
+#define __SOCKET_IO_METRICS_HPP__
+
+#include <boost/cstdint.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace socketio {
+
+   enum metric_counter
+   {
+      // Packets by socket.IO packet type (0 disconnect to 8 noop).
+      counter_packets_in = 0,
+      counter_packets_out = counter_packets_in + 9,
+      counter_bytes_in = counter_packets_out + 9,
+      counter_bytes_out,
+      counter_parse_errors,
+      counter_reconnects,
+      counter_heartbeat_misses,
+      counter_events_dropped,
+      counter_acks_evicted,
+      counter_count
+   };
+
+   // One connection's counters and gauges. Counters are written on the handler's io thread
+   // and may be read from any thread.
+   struct connection_metrics
+   {
+      connection_metrics() : pending_acks(0), queued_packets(0), buffered_bytes(0), connected(false)
+      {
+         for (int i = 0; i < counter_count; ++i) counters[i].store(0, std::memory_order_relaxed);
+      }
+
+      boost::uint64_t value(metric_counter c) const { return counters[c].load(std::memory_order_relaxed); }
+
+      std::atomic<boost::uint64_t> counters[counter_count];
+
+      // Gauges, refreshed when the registry is read.
+      std::size_t pending_acks;
+      std::size_t queued_packets;
+      std::size_t buffered_bytes;
+      bool connected;
+   };
+
+   class metrics_registry {
+   public:
+      // Fills in a connection's gauges. Called with the registry lock held.
+      typedef std::function<void (connection_metrics&)> gauge_reader;
+
+      static metrics_registry& instance()
+      {
+         static metrics_registry registry;
+         return registry;
+      }
+
+      // Adds n to counter c for the calling thread's slab and for connection m, if given.
+      void add(metric_counter c, boost::uint64_t n = 1, connection_metrics* m = NULL)
+      {
+         std::atomic<boost::uint64_t>& slot = local_slab().counters[c];
+         // Only this thread writes its slab, so there is no need for an atomic add.
+         slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+         if (m) m->counters[c].store(m->counters[c].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+      }
+
+      // Total of counter c over every thread.
+      boost::uint64_t value(metric_counter c) const
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         boost::uint64_t total = m_retired[c];
+         for (std::size_t i = 0; i < m_slabs.size(); ++i) total += m_slabs[i]->counters[c].load(std::memory_order_relaxed);
+         return total;
+      }
+
+      // Lists m under label in the output; gauges calls back into its owner. Unregister before
+      // either goes away.
+      void register_connection(connection_metrics* m, const std::string& label, const gauge_reader& gauges)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         for (std::size_t i = 0; i < m_connections.size(); ++i)
+         {
+            if (m_connections[i].metrics == m)
+            {
+               m_connections[i].label = label;
+               m_connections[i].gauges = gauges;
+               return;
+            }
+         }
+         connection c;
+         c.metrics = m;
+         c.label = label;
+         c.gauges = gauges;
+         m_connections.push_back(c);
+      }
+
+      void unregister_connection(connection_metrics* m)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         for (std::size_t i = 0; i < m_connections.size(); ++i)
+         {
+            if (m_connections[i].metrics == m)
+            {
+               m_connections.erase(m_connections.begin() + i);
+               return;
+            }
+         }
+      }
+
+      // Label for the next connection that doesn't pick its own.
+      std::string next_label()
+      {
+         return std::to_string(m_next_label.fetch_add(1, std::memory_order_relaxed));
+      }
+
+      // Only render the aggregate series, e.g. with many thousands of connections.
+      void set_per_connection(bool enabled) { m_per_connection = enabled; }
+
+      // Appends every metric in the Prometheus text format (version 0.0.4) to out.
+      void render(std::string& out) const
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         for (std::size_t i = 0; i < m_connections.size(); ++i)
+         {
+            if (m_connections[i].gauges) m_connections[i].gauges(*m_connections[i].metrics);
+         }
+
+         std::vector<boost::uint64_t> totals(m_retired, m_retired + counter_count);
+         for (std::size_t i = 0; i < m_slabs.size(); ++i)
+         {
+            for (int c = 0; c < counter_count; ++c) totals[c] += m_slabs[i]->counters[c].load(std::memory_order_relaxed);
+         }
+
+         bool per_connection = m_per_connection;
+         render_typed(out, "packets_received_total", "Socket.IO packets received, by packet type.", "counter", counter_packets_in, totals, per_connection);
+         render_typed(out, "packets_sent_total", "Socket.IO packets sent, by packet type.", "counter", counter_packets_out, totals, per_connection);
+         render_counter(out, "received_bytes_total", "Bytes of websocket payload received.", counter_bytes_in, totals, per_connection);
+         render_counter(out, "sent_bytes_total", "Bytes of websocket payload sent.", counter_bytes_out, totals, per_connection);
+         render_counter(out, "parse_errors_total", "Received frames or packets that could not be parsed.", counter_parse_errors, totals, per_connection);
+         render_counter(out, "reconnects_total", "Connections re-established after being lost.", counter_reconnects, totals, per_connection);
+         render_counter(out, "heartbeat_misses_total", "Connections closed because nothing arrived within the disconnect timeout.", counter_heartbeat_misses, totals, per_connection);
+         render_counter(out, "events_dropped_total", "Events dropped unparsed because nothing was registered for their name.", counter_events_dropped, totals, per_connection);
+         render_counter(out, "acks_evicted_total", "Acks given up because more than the maximum were in flight.", counter_acks_evicted, totals, per_connection);
+
+         header(out, "connections", "Handlers registered with the metrics registry.", "gauge");
+         out += "socketio_connections";
+         append_value(out, m_connections.size());
+         render_gauge(out, "connected", "Handlers with an open connection.", &connection_metrics::connected, per_connection);
+         render_gauge(out, "pending_acks", "Sent packets waiting for a server ack.", &connection_metrics::pending_acks, per_connection);
+         render_gauge(out, "queued_packets", "Outbound packets queued but not yet written by the io thread.", &connection_metrics::queued_packets, per_connection);
+         render_gauge(out, "buffered_bytes", "Outbound bytes not yet written to the socket.", &connection_metrics::buffered_bytes, per_connection);
+      }
+
+      std::string render() const
+      {
+         std::string out;
+         render(out);
+         return out;
+      }
+
+   private:
+      struct alignas(64) slab
+      {
+         slab()
+         {
+            for (int i = 0; i < counter_count; ++i) counters[i].store(0, std::memory_order_relaxed);
+         }
+
+         std::atomic<boost::uint64_t> counters[counter_count];
+      };
+
+      // Registers the thread's slab on first use and folds it into m_retired when the thread exits.
+      struct slab_owner
+      {
+         explicit slab_owner(metrics_registry& registry) : registry(registry)
+         {
+            std::lock_guard<std::mutex> lock(registry.m_mutex);
+            registry.m_slabs.push_back(&s);
+         }
+
+         ~slab_owner()
+         {
+            std::lock_guard<std::mutex> lock(registry.m_mutex);
+            for (int c = 0; c < counter_count; ++c) registry.m_retired[c] += s.counters[c].load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < registry.m_slabs.size(); ++i)
+            {
+               if (registry.m_slabs[i] == &s)
+               {
+                  registry.m_slabs.erase(registry.m_slabs.begin() + i);
+                  break;
+               }
+            }
+         }
+
+         metrics_registry& registry;
+         // Thread storage honours the slab's alignment, so no two threads share a line.
+         slab s;
+      };
+
+      struct connection
+      {
+         connection_metrics* metrics;
+         std::string label;
+         gauge_reader gauges;
+      };
+
+      metrics_registry() : m_next_label(1), m_per_connection(true)
+      {
+         for (int i = 0; i < counter_count; ++i) m_retired[i] = 0;
+      }
+      metrics_registry(const metrics_registry&);
+      metrics_registry& operator=(const metrics_registry&);
+
+      slab& local_slab()
+      {
+         static thread_local slab_owner owner(*this);
+         return owner.s;
+      }
+
+      static void header(std::string& out, const char* name, const char* help, const char* type)
+      {
+         out += "# HELP socketio_";
+         out += name;
+         out += ' ';
+         out += help;
+         out += "\n# TYPE socketio_";
+         out += name;
+         out += ' ';
+         out += type;
+         out += '\n';
+      }
+
+      static void append_value(std::string& out, boost::uint64_t value)
+      {
+         char buffer[24];
+         std::snprintf(buffer, sizeof(buffer), " %llu\n", (unsigned long long)value);
+         out += buffer;
+      }
+
+      // Label values escape backslash, double quote and newline.
+      static void append_label(std::string& out, const char* name, const std::string& value)
+      {
+         out += name;
+         out += "=\"";
+         for (std::size_t i = 0; i < value.size(); ++i)
+         {
+            if (value[i] == '\\') out += "\\\\";
+            else if (value[i] == '"') out += "\\\"";
+            else if (value[i] == '\n') out += "\\n";
+            else out += value[i];
+         }
+         out += '"';
+      }
+
+      static const char* type_name(int type)
+      {
+         static const char* const names[] = { "disconnect", "connect", "heartbeat", "message", "json", "event", "ack", "error", "noop" };
+         return names[type];
+      }
+
+      void render_typed(std::string& out, const char* name, const char* help, const char* type, metric_counter first,
+         const std::vector<boost::uint64_t>& totals, bool per_connection) const
+      {
+         header(out, name, help, type);
+         for (int t = 0; t < 9; ++t)
+         {
+            out += "socketio_";
+            out += name;
+            out += "{type=\"";
+            out += type_name(t);
+            out += "\"}";
+            append_value(out, totals[first + t]);
+         }
+         if (!per_connection) return;
+         header(out, (std::string("connection_") + name).c_str(), help, type);
+         for (std::size_t i = 0; i < m_connections.size(); ++i)
+         {
+            for (int t = 0; t < 9; ++t)
+            {
+               out += "socketio_connection_";
+               out += name;
+               out += '{';
+               append_label(out, "connection", m_connections[i].label);
+               out += ",type=\"";
+               out += type_name(t);
+               out += "\"}";
+               append_value(out, m_connections[i].metrics->value(metric_counter(first + t)));
+            }
+         }
+      }
+
+      void render_counter(std::string& out, const char* name, const char* help, metric_counter c,
+         const std::vector<boost::uint64_t>& totals, bool per_connection) const
+      {
+         header(out, name, help, "counter");
+         out += "socketio_";
+         out += name;
+         append_value(out, totals[c]);
+         if (!per_connection) return;
+         header(out, (std::string("connection_") + name).c_str(), help, "counter");
+         for (std::size_t i = 0; i < m_connections.size(); ++i)
+         {
+            out += "socketio_connection_";
+            out += name;
+            out += '{';
+            append_label(out, "connection", m_connections[i].label);
+            out += '}';
+            append_value(out, m_connections[i].metrics->value(c));
+         }
+      }
+
+      template <typename T>
+      void render_gauge(std::string& out, const char* name, const char* help, T connection_metrics::* field, bool per_connection) const
+      {
+         header(out, name, help, "gauge");
+         boost::uint64_t total = 0;
+         for (std::size_t i = 0; i < m_connections.size(); ++i)
+         {
+            total += boost::uint64_t(m_connections[i].metrics->*field);
+         }
+         out += "socketio_";
+         out += name;
+         append_value(out, total);
+         if (!per_connection) return;
+         header(out, (std::string("connection_") + name).c_str(), help, "gauge");
+         for (std::size_t i = 0; i < m_connections.size(); ++i)
+         {
+            out += "socketio_connection_";
+            out += name;
+            out += '{';
+            append_label(out, "connection", m_connections[i].label);
+            out += '}';
+            append_value(out, boost::uint64_t(m_connections[i].metrics->*field));
+         }
+      }
+
+      mutable std::mutex m_mutex;
+      std::vector<slab*> m_slabs;
+      boost::uint64_t m_retired[counter_count];
+      std::vector<connection> m_connections;
+      std::atomic<unsigned long> m_next_label;
+      std::atomic<bool> m_per_connection;
+   };
+
+}
+
+#endif // __SOCKET_IO_METRICS_HPP__
@@ -0,0 +1,399 @@
+/* socket_io_packet.hpp
+* socket.io 0.9 packet encoding and decoding.
+* https://github.com/LearnBoost/socket.io-spec
+*
+* Incoming frames are tokenized in place: parse_packet() returns views into the
+* websocket payload and reads the numeric fields with a digit lookup table.
+*
+* Outgoing packets are written straight into the buffer that is handed to the send queue:
+* the "[type]:[id]:[endpoint]:" header comes from packet_prefixes, built once per
+* endpoint and either cached by the encoder or held by a namespace object, and
+* JSON bodies are streamed by rapidjson, or for event_args by json::write, into the
+* same string, so no intermediate streams or copies are involved.
+*
+* Several packets can share one frame as "\ufffd[length]\ufffd[packet]..." where
+* length counts UTF-16 code units, as the javascript client and server do.
+*/
+
+#ifndef __SOCKET_IO_PACKET_HPP__
+#define __SOCKET_IO_PACKET_HPP__
+
+#include <rapidjson/document.h>
+#include <rapidjson/stringwriter.h>
+#include <boost/utility/string_ref.hpp>
+
+#include "socket_io_serialize.hpp"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace socketio {
+
+   enum packet_type
+   {
+      type_disconnect = 0,
+      type_connect = 1,
+      type_heartbeat = 2,
+      type_message = 3,
+      type_json = 4,
+      type_event = 5,
+      type_ack = 6,
+      type_error = 7,
+      type_noop = 8
+   };
+
+   // Digit value of every byte, or -1 for non-digits.
+   struct digit_table {
+      static signed char value(char c)
+      {
+         static const signed char table[256] = {
+#define N16 -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+            N16, N16, N16,                                          // 00~2F
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1,  // 30
+            N16, N16, N16, N16, N16, N16, N16, N16, N16, N16, N16, N16  // 40~FF
+#undef N16
+         };
+         return table[(unsigned char)c];
+      }
+   };
+
+   // Reads an unsigned decimal number from [p, end). Returns the number of digits consumed;
+   // value is left untouched when that is 0.
+   inline std::size_t parse_uint(const char* p, const char* end, unsigned int& value)
+   {
+      const char* begin = p;
+      unsigned int v = 0;
+      signed char d;
+      while (p != end && (d = digit_table::value(*p)) >= 0)
+      {
+         v = v * 10 + unsigned(d);
+         ++p;
+      }
+      if (p != begin) value = v;
+      return std::size_t(p - begin);
+   }
+
+   // A tokenized "[type]:[id]:[endpoint]:[data]" packet. The views point into the parsed frame.
+   struct packet_view {
+      packet_view() : type(-1), id(0), ack_data(false)
+      {}
+
+      int type;                   // -1 when the type field isn't a number
+      unsigned int id;            // 0 when the packet has no id
+      bool ack_data;              // the id was followed by '+'
+      boost::string_ref endpoint;
+      boost::string_ref data;     // not zero terminated inside a multi-packet frame
+   };
+
+   // Splits a frame into its fields without copying. Returns false when the frame
+   // has no ':' at all and so isn't a socket.IO packet.
+   inline bool parse_packet(const char* frame, std::size_t length, packet_view& out)
+   {
+      const char* end = frame + length;
+      const char* type_end = std::char_traits<char>::find(frame, length, ':');
+      if (!type_end) return false;
+
+      out = packet_view();
+      unsigned int type = 0;
+      if (parse_uint(frame, type_end, type) > 0) out.type = int(type);
+
+      const char* p = type_end + 1;
+      const char* id_end = p != end ? std::char_traits<char>::find(p, std::size_t(end - p), ':') : NULL;
+      if (!id_end)
+      {
+         parse_uint(p, end, out.id);
+         return true;
+      }
+      std::size_t digits = parse_uint(p, id_end, out.id);
+      out.ack_data = p + digits != id_end && p[digits] == '+';
+
+      p = id_end + 1;
+      const char* endpoint_end = p != end ? std::char_traits<char>::find(p, std::size_t(end - p), ':') : NULL;
+      if (!endpoint_end)
+      {
+         out.endpoint = boost::string_ref(p, std::size_t(end - p));
+         return true;
+      }
+      out.endpoint = boost::string_ref(p, std::size_t(endpoint_end - p));
+      out.data = boost::string_ref(endpoint_end + 1, std::size_t(end - endpoint_end - 1));
+      return true;
+   }
+
+   // U+FFFD in UTF-8, the separator of multi-packet frames.
+   static const char frame_marker[] = "\xEF\xBF\xBD";
+   static const std::size_t frame_marker_size = 3;
+
+   inline bool is_framed(const char* frame, std::size_t length)
+   {
+      return length >= frame_marker_size && std::char_traits<char>::compare(frame, frame_marker, frame_marker_size) == 0;
+   }
+
+   // Number of UTF-16 code units in a UTF-8 string: one per character, two for characters
+   // outside the BMP (4-byte sequences).
+   inline std::size_t utf16_length(const char* p, std::size_t length)
+   {
+      std::size_t units = 0;
+      for (std::size_t i = 0; i < length; ++i)
+      {
+         unsigned char c = (unsigned char)p[i];
+         if ((c & 0xC0) != 0x80) ++units;
+         if (c >= 0xF0) ++units;
+      }
+      return units;
+   }
+
+   // Splits the next packet off a multi-packet frame, advancing p past it. Returns false at
+   // the end of the frame or on a malformed length.
+   inline bool next_framed_packet(const char*& p, const char* end, boost::string_ref& out)
+   {
+      if (std::size_t(end - p) < frame_marker_size || !is_framed(p, std::size_t(end - p))) return false;
+      const char* q = p + frame_marker_size;
+      unsigned int units = 0;
+      std::size_t digits = parse_uint(q, end, units);
+      q += digits;
+      if (digits == 0 || std::size_t(end - q) < frame_marker_size || !is_framed(q, std::size_t(end - q))) return false;
+      q += frame_marker_size;
+
+      // Walk the UTF-8 sequences until the packet's UTF-16 length is used up.
+      const char* packet = q;
+      std::size_t counted = 0;
+      while (counted < units && q < end)
+      {
+         unsigned char c = (unsigned char)*q;
+         std::size_t size = c < 0x80 ? 1 : (c < 0xE0 ? 2 : (c < 0xF0 ? 3 : 4));
+         counted += size == 4 ? 2 : 1;
+         q += size;
+      }
+      if (counted != units || q > end) return false;
+      out = boost::string_ref(packet, std::size_t(q - packet));
+      p = q;
+      return true;
+   }
+
+   // rapidjson output stream that appends to a std::string.
+   class string_output_stream {
+   public:
+      explicit string_output_stream(std::string& out) : m_out(out)
+      {}
+
+      void put(char c) { m_out.push_back(c); }
+      void Put(char c) { m_out.push_back(c); }
+      void Flush() {}
+
+   private:
+      std::string& m_out;
+   };
+
+   // Appends the decimal representation of value to out.
+   inline void append_uint(std::string& out, unsigned int value)
+   {
+      char digits[10];
+      char* p = digits;
+      do
+      {
+         *p++ = char('0' + value % 10);
+         value /= 10;
+      } while (value > 0);
+      while (p != digits) out.push_back(*--p);
+   }
+
+   // Appends packet to a multi-packet frame.
+   inline void append_framed(std::string& out, const std::string& packet)
+   {
+      out.append(frame_marker, frame_marker_size);
+      append_uint(out, unsigned(utf16_length(packet.data(), packet.size())));
+      out.append(frame_marker, frame_marker_size);
+      out.append(packet);
+   }
+
+   // "[type]::[endpoint]:" for every packet type, built once for an endpoint.
+   struct packet_prefixes {
+      packet_prefixes()
+      {}
+
+      explicit packet_prefixes(const std::string& endpoint)
+      {
+         for (unsigned int type = 0; type <= type_noop; ++type)
+         {
+            std::string& p = prefix[type];
+            p.reserve(endpoint.size() + 4);
+            p.push_back(char('0' + type));
+            p.append("::");
+            p.append(endpoint);
+            p.push_back(':');
+         }
+      }
+
+      std::string prefix[type_noop + 1];
+   };
+
+   class packet_encoder {
+   public:
+      typedef rapidjson::MemoryPoolAllocator<> writer_allocator;
+      typedef rapidjson::StreamWriter<string_output_stream, rapidjson::UTF8<>, writer_allocator> writer_type;
+
+      packet_encoder() : m_size_hint(64)
+      {}
+
+      // Reserves room for a typical packet so the body rarely has to grow the buffer.
+      void reserve(std::string& out) const
+      {
+         out.reserve(out.size() + m_size_hint.load(std::memory_order_relaxed));
+      }
+
+      // Appends "[type]:[id]:[endpoint]:". The id is omitted when it is 0.
+      static void write_header(std::string& out, unsigned int type, const packet_prefixes& prefixes, unsigned int id = 0)
+      {
+         const std::string& p = prefixes.prefix[type];
+         if (id == 0)
+         {
+            out.append(p);
+            return;
+         }
+         // Prefixes are "[type]::[endpoint]:"; the id goes after the first colon.
+         out.append(p, 0, 2);
+         append_uint(out, id);
+         out.append(p, 2, std::string::npos);
+      }
+
+      // Same, with the prefixes looked up in the encoder's cache.
+      void write_header(std::string& out, unsigned int type, const std::string& endpoint, unsigned int id = 0)
+      {
+         if (type > type_noop)
+         {
+            append_uint(out, type);
+            out.push_back(':');
+            if (id > 0) append_uint(out, id);
+            out.push_back(':');
+            out.append(endpoint);
+            out.push_back(':');
+            return;
+         }
+
+         write_header(out, type, prefixes(endpoint), id);
+      }
+
+      // [type]:[id]:[endpoint]:[msg]
+      template <typename Endpoint>
+      void encode(std::string& out, unsigned int type, const Endpoint& endpoint, const std::string& msg, unsigned int id = 0)
+      {
+         out.reserve(out.size() + header_size(endpoint) + msg.size());
+         write_header(out, type, endpoint, id);
+         out.append(msg);
+         remember_size(out);
+      }
+
+      // [type]::[endpoint], used for connect and disconnect packets.
+      template <typename Endpoint>
+      void encode_endpoint(std::string& out, unsigned int type, const Endpoint& endpoint)
+      {
+         write_header(out, type, endpoint);
+         out.resize(out.size() - 1);
+      }
+
+      // [type]:[id]:[endpoint]:[json]
+      template <typename Endpoint>
+      void encode_json(std::string& out, unsigned int type, const Endpoint& endpoint, rapidjson::Value& json, unsigned int id = 0)
+      {
+         reserve(out);
+         write_header(out, type, endpoint, id);
+         write_json(out, json);
+         remember_size(out);
+      }
+
+      // 5:[id]:[endpoint]:{"name":[name],...} where the remaining members come from args.
+      // args is normally an object holding an "args" array; anything else becomes the "args" member.
+      template <typename Endpoint>
+      void encode_event(std::string& out, const Endpoint& endpoint, const std::string& name, rapidjson::Value& args, unsigned int id = 0)
+      {
+         reserve(out);
+         write_header(out, type_event, endpoint, id);
+
+         double stack_buffer[128];
+         writer_allocator allocator(reinterpret_cast<char*>(stack_buffer), sizeof(stack_buffer));
+         string_output_stream stream(out);
+         writer_type writer(stream, &allocator);
+
+         writer.StartObject();
+         writer.String("name", 4);
+         writer.String(name.data(), rapidjson::SizeType(name.length()));
+         if (args.IsObject())
+         {
+            for (rapidjson::Value::MemberIterator it = args.MemberBegin(); it != args.MemberEnd(); ++it)
+            {
+               // A "name" member in args would shadow the event name.
+               if (it->name.GetStringLength() == 4 && std::char_traits<char>::compare(it->name.GetString(), "name", 4) == 0) continue;
+               it->name.Accept(writer);
+               it->value.Accept(writer);
+            }
+         }
+         else if (!args.IsNull())
+         {
+            writer.String("args", 4);
+            args.Accept(writer);
+         }
+         writer.EndObject();
+         remember_size(out);
+      }
+
+      // 5:[id]:[endpoint]:{"name":[name],"args":[...]} with args written by json::write.
+      template <typename Endpoint, typename... Ts>
+      void encode_event(std::string& out, const Endpoint& endpoint, const std::string& name, const event_args<Ts...>& args, unsigned int id = 0)
+      {
+         reserve(out);
+         write_header(out, type_event, endpoint, id);
+         json::append_literal(out, "{\"name\":");
+         json::write_string(out, name.data(), name.size());
+         json::append_literal(out, ",\"args\":");
+         json::write(out, args);
+         out.push_back('}');
+         remember_size(out);
+      }
+
+      // Streams json into out without an intermediate buffer. (rapidjson's Accept isn't const.)
+      static void write_json(std::string& out, rapidjson::Value& json)
+      {
+         // The writer's nesting stack lives on the stack unless the JSON is very deep.
+         double stack_buffer[128];
+         writer_allocator allocator(reinterpret_cast<char*>(stack_buffer), sizeof(stack_buffer));
+         string_output_stream stream(out);
+         writer_type writer(stream, &allocator);
+         json.Accept(writer);
+      }
+
+   private:
+      packet_encoder(const packet_encoder&);
+      packet_encoder& operator=(const packet_encoder&);
+
+      // Returns the cached prefixes for endpoint. Entries are never erased, so the
+      // reference stays valid after the lock is released.
+      const packet_prefixes& prefixes(const std::string& endpoint)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         std::map<std::string, packet_prefixes>::iterator it = m_prefixes.find(endpoint);
+         if (it == m_prefixes.end())
+         {
+            it = m_prefixes.insert(std::make_pair(endpoint, packet_prefixes(endpoint))).first;
+         }
+         return it->second;
+      }
+
+      // Room for the header, id included.
+      static std::size_t header_size(const std::string& endpoint) { return endpoint.size() + 16; }
+      static std::size_t header_size(const packet_prefixes& prefixes) { return prefixes.prefix[0].size() + 12; }
+
+      void remember_size(const std::string& out)
+      {
+         m_size_hint.store(out.size(), std::memory_order_relaxed);
+      }
+
+      std::mutex m_mutex;
+      std::map<std::string, packet_prefixes> m_prefixes;
+      std::atomic<std::size_t> m_size_hint;
+   };
+
+}
+
+#endif // __SOCKET_IO_PACKET_HPP__
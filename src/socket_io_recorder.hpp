@@ -0,0 +1,148 @@
+/* socket_io_recorder.hpp
+* Capture of a handler's websocket traffic for offline replay.
+*
+* traffic_recorder appends every inbound and outbound frame to a binary file:
+* an 8 byte magic ("SIOTRC01") followed by records of
+*
+*    u64 timestamp (steady clock, nanoseconds)  u32 length  u8 direction  payload
+*
+* all little endian. Writes go through a large stdio buffer under a mutex, so one
+* recorder can be shared by several handlers. traffic_reader memory-maps such a
+* file and walks the records without copying them; a record cut short by a crash
+* ends the file.
+*/
+
+#ifndef __SOCKET_IO_RECORDER_HPP__
+#define __SOCKET_IO_RECORDER_HPP__
+
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace socketio {
+
+   enum traffic_direction
+   {
+      traffic_inbound = 0,
+      traffic_outbound = 1
+   };
+
+   struct traffic_record
+   {
+      boost::uint64_t timestamp;   // steady clock nanoseconds
+      traffic_direction direction;
+      boost::string_ref payload;
+   };
+
+   static const char traffic_magic[] = "SIOTRC01";
+   static const std::size_t traffic_magic_size = 8;
+   static const std::size_t traffic_header_size = 13;
+
+   class traffic_recorder {
+   public:
+      // Opens path for appending, writing the magic if the file is new or empty. Throws
+      // std::runtime_error if it can't be opened.
+      explicit traffic_recorder(const std::string& path, std::size_t buffer_size = 1 << 20) :
+         m_buffer(new char[buffer_size])
+      {
+         m_file = std::fopen(path.c_str(), "ab");
+         if (!m_file) throw std::runtime_error("Could not open " + path + " for recording");
+         std::setvbuf(m_file, m_buffer.get(), _IOFBF, buffer_size);
+         std::fseek(m_file, 0, SEEK_END);
+         if (std::ftell(m_file) == 0) std::fwrite(traffic_magic, 1, traffic_magic_size, m_file);
+      }
+
+      ~traffic_recorder()
+      {
+         std::fclose(m_file);
+      }
+
+      void record(traffic_direction direction, const char* data, std::size_t length)
+      {
+         unsigned char header[traffic_header_size];
+         boost::uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+         for (int i = 0; i < 8; ++i) header[i] = (unsigned char)(timestamp >> (8 * i));
+         for (int i = 0; i < 4; ++i) header[8 + i] = (unsigned char)(boost::uint32_t(length) >> (8 * i));
+         header[12] = (unsigned char)direction;
+
+         std::lock_guard<std::mutex> lock(m_mutex);
+         std::fwrite(header, 1, sizeof(header), m_file);
+         std::fwrite(data, 1, length, m_file);
+      }
+
+      // Pushes buffered records to the file.
+      void flush()
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         std::fflush(m_file);
+      }
+
+   private:
+      traffic_recorder(const traffic_recorder&);
+      traffic_recorder& operator=(const traffic_recorder&);
+
+      std::mutex m_mutex;
+      std::unique_ptr<char[]> m_buffer;
+      std::FILE* m_file;
+   };
+
+   class traffic_reader {
+   public:
+      // Maps path read-only. Throws std::runtime_error if it isn't a recording, and
+      // boost::interprocess::interprocess_exception if it can't be mapped.
+      explicit traffic_reader(const std::string& path) :
+         m_mapping(path.c_str(), boost::interprocess::read_only),
+         m_region(m_mapping, boost::interprocess::read_only)
+      {
+         m_begin = static_cast<const char*>(m_region.get_address());
+         m_end = m_begin + m_region.get_size();
+         if (std::size_t(m_end - m_begin) < traffic_magic_size || std::memcmp(m_begin, traffic_magic, traffic_magic_size) != 0)
+         {
+            throw std::runtime_error(path + " is not a socket.IO traffic recording");
+         }
+         rewind();
+      }
+
+      // Reads the next record; its payload points into the mapping. Returns false at the end.
+      bool next(traffic_record& record)
+      {
+         if (std::size_t(m_end - m_position) < traffic_header_size) return false;
+         const unsigned char* header = reinterpret_cast<const unsigned char*>(m_position);
+         boost::uint64_t timestamp = 0;
+         for (int i = 7; i >= 0; --i) timestamp = timestamp << 8 | header[i];
+         boost::uint32_t length = 0;
+         for (int i = 3; i >= 0; --i) length = length << 8 | header[8 + i];
+         if (std::size_t(m_end - m_position) - traffic_header_size < length) return false;
+
+         record.timestamp = timestamp;
+         record.direction = header[12] == traffic_outbound ? traffic_outbound : traffic_inbound;
+         record.payload = boost::string_ref(m_position + traffic_header_size, length);
+         m_position += traffic_header_size + length;
+         return true;
+      }
+
+      void rewind() { m_position = m_begin + traffic_magic_size; }
+
+      // Size of the mapped file in bytes.
+      std::size_t size() const { return std::size_t(m_end - m_begin); }
+
+   private:
+      boost::interprocess::file_mapping m_mapping;
+      boost::interprocess::mapped_region m_region;
+      const char* m_begin;
+      const char* m_end;
+      const char* m_position;
+   };
+
+}
+
+#endif // __SOCKET_IO_RECORDER_HPP__
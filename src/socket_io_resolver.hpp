@@ -0,0 +1,285 @@
+/* socket_io_resolver.hpp
+* Process-wide DNS cache and parallel connect for the socket.IO handshake.
+*
+* resolver_cache keeps resolved addresses per host:port for a fixed TTL (asio does
+* not expose the record's own TTL) and coalesces concurrent lookups: when thousands
+* of sessions reconnect to the same host at once, one query goes out and every
+* caller gets its answer on its own io_service. Lookups run on an io_service and
+* thread of the cache's own, so no caller's lifetime decides whether one finishes.
+* connect_race then connects to all resolved addresses at the same time and keeps
+* whichever completes first.
+*/
+
+#ifndef __SOCKET_IO_RESOLVER_HPP__
+#define __SOCKET_IO_RESOLVER_HPP__
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace socketio {
+
+   class resolver_cache {
+   public:
+      typedef std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+      typedef std::function<void (const boost::system::error_code&, const endpoints&)> handler;
+      typedef std::chrono::steady_clock clock;
+      // Identifies a resolve() waiting for a lookup; 0 when it was answered from the cache.
+      typedef std::size_t request_id;
+
+      // The cache shared by every handler in the process.
+      static resolver_cache& instance()
+      {
+         static resolver_cache cache;
+         return cache;
+      }
+
+      // How long resolved addresses are reused. Defaults to 60 seconds; zero disables caching
+      // but still coalesces concurrent lookups.
+      void set_ttl(clock::duration ttl)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_ttl = ttl;
+      }
+
+      // Resolves host:port and calls h on io_service with the addresses. Answers come from the
+      // cache while fresh; otherwise the caller joins the lookup in flight or starts one. Until
+      // h is posted, the returned id can be passed to cancel().
+      request_id resolve(boost::asio::io_service& io_service, const std::string& host, const std::string& port, const handler& h)
+      {
+         std::string key = host + ":" + port;
+         request_id id;
+         {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            entry& e = m_entries[key];
+            if (!e.pending && !e.addresses.empty() && clock::now() < e.expires)
+            {
+               endpoints addresses(e.addresses);
+               io_service.post([h, addresses]() {
+                  h(boost::system::error_code(), addresses);
+               });
+               return 0;
+            }
+            id = m_next_request++;
+            e.waiters.push_back(waiter(id, &io_service, h));
+            if (e.pending) return id;
+            e.pending = true;
+            ++m_lookups;
+         }
+
+         std::shared_ptr<boost::asio::ip::tcp::resolver> resolver(new boost::asio::ip::tcp::resolver(m_io_service));
+         boost::asio::ip::tcp::resolver::query query(host, port);
+         resolver->async_resolve(query, [this, resolver, key](const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator it) {
+            endpoints addresses;
+            for (boost::asio::ip::tcp::resolver::iterator end; !ec && it != end; ++it)
+            {
+               addresses.push_back(it->endpoint());
+            }
+            finish(key, ec, addresses);
+         });
+         return id;
+      }
+
+      // Withdraws request id: its handler is dropped without being called and its io_service
+      // is no longer kept running. Returns false if the answer was already posted.
+      bool cancel(request_id id)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         for (std::map<std::string, entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+         {
+            std::vector<waiter>& waiters = it->second.waiters;
+            for (std::size_t i = 0; i < waiters.size(); ++i)
+            {
+               if (waiters[i].id != id) continue;
+               waiters.erase(waiters.begin() + i);
+               return true;
+            }
+         }
+         return false;
+      }
+
+      // Forgets host:port, e.g. after none of its addresses could be reached.
+      void invalidate(const std::string& host, const std::string& port)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         std::map<std::string, entry>::iterator it = m_entries.find(host + ":" + port);
+         if (it != m_entries.end() && !it->second.pending) m_entries.erase(it);
+      }
+
+      // DNS queries actually sent, as opposed to answered from the cache or coalesced.
+      std::size_t lookups() const
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         return m_lookups;
+      }
+
+   private:
+      resolver_cache() : m_work(new boost::asio::io_service::work(m_io_service)),
+         m_ttl(std::chrono::seconds(60)),
+         m_lookups(0),
+         m_next_request(1)
+      {
+         m_thread = std::thread([this]() { m_io_service.run(); });
+      }
+
+      ~resolver_cache()
+      {
+         m_work.reset();
+         m_io_service.stop();
+         m_thread.join();
+      }
+
+      resolver_cache(const resolver_cache&);
+      resolver_cache& operator=(const resolver_cache&);
+
+      struct waiter
+      {
+         waiter(request_id id, boost::asio::io_service* io_service, const handler& h) : id(id), io_service(io_service), h(h),
+            work(new boost::asio::io_service::work(*io_service))
+         {}
+
+         request_id id;
+         boost::asio::io_service* io_service;
+         handler h;
+         // Keeps the waiter's io_service running while the cache's performs the lookup.
+         std::shared_ptr<boost::asio::io_service::work> work;
+      };
+
+      struct entry
+      {
+         entry() : pending(false)
+         {}
+
+         endpoints addresses;
+         clock::time_point expires;
+         bool pending;
+         std::vector<waiter> waiters;
+      };
+
+      // Posts the answer to every waiter. The lock is held while posting, so once cancel()
+      // has returned false the handler is already queued on its io_service.
+      void finish(const std::string& key, const boost::system::error_code& ec, const endpoints& addresses)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         std::vector<waiter> waiters;
+         entry& e = m_entries[key];
+         e.pending = false;
+         e.waiters.swap(waiters);
+         if (!ec && !addresses.empty())
+         {
+            e.addresses = addresses;
+            e.expires = clock::now() + m_ttl;
+         }
+         for (std::size_t i = 0; i < waiters.size(); ++i)
+         {
+            handler h = waiters[i].h;
+            std::shared_ptr<boost::asio::io_service::work> work = waiters[i].work;
+            waiters[i].io_service->post([h, work, ec, addresses]() {
+               h(ec, addresses);
+            });
+         }
+      }
+
+      // Lookups complete here rather than on the io_service of whoever asked first.
+      boost::asio::io_service m_io_service;
+      std::unique_ptr<boost::asio::io_service::work> m_work;
+      std::thread m_thread;
+
+      mutable std::mutex m_mutex;
+      std::map<std::string, entry> m_entries;
+      clock::duration m_ttl;
+      std::size_t m_lookups;
+      request_id m_next_request;
+   };
+
+   // Connects to every address at once and hands over the first socket that connects; the
+   // others are closed. Runs on one io_service thread.
+   class connect_race {
+   public:
+      // socket is NULL when every attempt failed; ec is then the last failure.
+      typedef std::function<void (const boost::system::error_code& ec, boost::asio::ip::tcp::socket* socket)> handler;
+
+      static std::shared_ptr<connect_race> start(boost::asio::io_service& io_service, const resolver_cache::endpoints& addresses,
+         const handler& h, std::size_t max_parallel = 8)
+      {
+         std::shared_ptr<connect_race> race(new connect_race(h));
+         std::size_t count = addresses.size() < max_parallel ? addresses.size() : max_parallel;
+         race->m_remaining = count;
+         if (count == 0)
+         {
+            io_service.post([race]() {
+               race->finish(boost::asio::error::host_not_found, NULL);
+            });
+            return race;
+         }
+         for (std::size_t i = 0; i < count; ++i)
+         {
+            race->m_sockets.push_back(std::unique_ptr<boost::asio::ip::tcp::socket>(new boost::asio::ip::tcp::socket(io_service)));
+         }
+         for (std::size_t i = 0; i < count; ++i)
+         {
+            race->m_sockets[i]->async_connect(addresses[i], [race, i](const boost::system::error_code& ec) {
+               race->attempt_done(i, ec);
+            });
+         }
+         return race;
+      }
+
+      // Abandons the race; the handler is not called.
+      void cancel()
+      {
+         m_done = true;
+         close_all();
+      }
+
+   private:
+      explicit connect_race(const handler& h) : m_handler(h), m_remaining(0), m_done(false)
+      {}
+
+      void attempt_done(std::size_t index, const boost::system::error_code& ec)
+      {
+         if (m_done) return;
+         if (!ec)
+         {
+            m_done = true;
+            std::unique_ptr<boost::asio::ip::tcp::socket> winner;
+            winner.swap(m_sockets[index]);
+            close_all();
+            m_handler(ec, winner.get());
+            return;
+         }
+         if (--m_remaining == 0) finish(ec, NULL);
+      }
+
+      void finish(const boost::system::error_code& ec, boost::asio::ip::tcp::socket* socket)
+      {
+         if (m_done) return;
+         m_done = true;
+         m_handler(ec, socket);
+      }
+
+      void close_all()
+      {
+         boost::system::error_code ignored;
+         for (std::size_t i = 0; i < m_sockets.size(); ++i)
+         {
+            if (m_sockets[i]) m_sockets[i]->close(ignored);
+         }
+      }
+
+      handler m_handler;
+      std::vector<std::unique_ptr<boost::asio::ip::tcp::socket> > m_sockets;
+      std::size_t m_remaining;
+      bool m_done;
+   };
+
+}
+
+#endif // __SOCKET_IO_RESOLVER_HPP__
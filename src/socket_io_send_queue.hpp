@@ -0,0 +1,109 @@
+/* socket_io_send_queue.hpp
+* Lock-free multi-producer, single-consumer queue used for the outbound packet path.
+*
+* Producers push onto an atomic singly linked list. The consumer (the io thread)
+* detaches the whole list with one exchange and walks it in FIFO order, so a burst
+* of sends from any number of threads costs a single wakeup of the event loop.
+*/
+
+#ifndef __SOCKET_IO_SEND_QUEUE_HPP__
+#define __SOCKET_IO_SEND_QUEUE_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace socketio {
+
+   template <typename T>
+   class mpsc_queue {
+   public:
+      mpsc_queue() : m_head(NULL), m_depth(0)
+      {}
+
+      ~mpsc_queue()
+      {
+         node* n = m_head.load(std::memory_order_acquire);
+         while (n)
+         {
+            node* next = n->next;
+            delete n;
+            n = next;
+         }
+      }
+
+      // Safe to call from any thread. Returns true when the queue was empty before
+      // the push, i.e. when the caller is responsible for scheduling a drain.
+      bool push(T value)
+      {
+         node* n = new node(std::move(value));
+         m_depth.fetch_add(1, std::memory_order_relaxed);
+
+         node* head = m_head.load(std::memory_order_relaxed);
+         do
+         {
+            n->next = head;
+         } while (!m_head.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+
+         return head == NULL;
+      }
+
+      // Consumer only. Hands every queued element to func in push order and returns
+      // how many were drained.
+      template <typename Func>
+      std::size_t drain(Func func)
+      {
+         node* list = m_head.exchange(NULL, std::memory_order_acquire);
+
+         // The list is newest first; reverse it to restore push order.
+         node* ordered = NULL;
+         while (list)
+         {
+            node* next = list->next;
+            list->next = ordered;
+            ordered = list;
+            list = next;
+         }
+
+         std::size_t count = 0;
+         while (ordered)
+         {
+            node* next = ordered->next;
+            func(ordered->value);
+            delete ordered;
+            ordered = next;
+            ++count;
+         }
+         m_depth.fetch_sub(count, std::memory_order_relaxed);
+         return count;
+      }
+
+      // Approximate number of queued elements; exact when no push is in flight.
+      std::size_t depth() const
+      {
+         return m_depth.load(std::memory_order_relaxed);
+      }
+
+      bool empty() const
+      {
+         return m_head.load(std::memory_order_relaxed) == NULL;
+      }
+
+   private:
+      mpsc_queue(const mpsc_queue&);
+      mpsc_queue& operator=(const mpsc_queue&);
+
+      struct node
+      {
+         explicit node(T&& v) : value(std::move(v)), next(NULL) {}
+         T value;
+         node* next;
+      };
+
+      std::atomic<node*> m_head;
+      std::atomic<std::size_t> m_depth;
+   };
+
+}
+
+#endif // __SOCKET_IO_SEND_QUEUE_HPP__
@@ -0,0 +1,458 @@
+/* socket_io_serialize.hpp
+* Direct JSON serialization of C++ values, for emitting events without a DOM, and
+* binding of decoded JSON back onto them.
+*
+* json::write() appends the JSON form of a value to a std::string: bools, integers,
+* floating point numbers, strings (std::string, C strings, boost::string_ref),
+* std::vector, std::map with string keys, and structs whose fields were declared with
+* SOCKETIO_STRUCT. Object keys of such structs are string literals put together by the
+* preprocessor, so writing one is a series of appends.
+*
+* event_args holds references to the arguments of one emit; socketio::args() makes one:
+*
+*    handler.emit("trade", socketio::args(42, 1.5, "buy", levels));
+*
+* For reading, json::bind() pairs a value with a value_binder, a table of functions
+* that store decoded numbers, strings and members straight into it. Struct members
+* are found by switching on the key's hash; SOCKETIO_STRUCT computes the hash of
+* every field name at compile time.
+*/
+
+#ifndef __SOCKET_IO_SERIALIZE_HPP__
+#define __SOCKET_IO_SERIALIZE_HPP__
+
+#include <boost/preprocessor/control/if.hpp>
+#include <boost/preprocessor/seq/for_each.hpp>
+#include <boost/preprocessor/seq/for_each_i.hpp>
+#include <boost/preprocessor/stringize.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include "socket_io_dispatch.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace socketio {
+
+   namespace json {
+
+      // Appends a string literal without measuring it.
+      template <std::size_t N>
+      inline void append_literal(std::string& out, const char (&literal)[N])
+      {
+         out.append(literal, N - 1);
+      }
+
+      // Declared up front so that containers of containers find each other.
+      inline void write(std::string& out, bool value);
+      inline void write(std::string& out, double value);
+      inline void write(std::string& out, float value);
+      inline void write(std::string& out, const char* value);
+      inline void write(std::string& out, const std::string& value);
+      inline void write(std::string& out, boost::string_ref value);
+      inline void write(std::string& out, std::nullptr_t);
+
+      template <typename T>
+      inline typename std::enable_if<std::is_integral<T>::value>::type write(std::string& out, T value);
+
+      template <typename T, typename A>
+      inline void write(std::string& out, const std::vector<T, A>& values);
+
+      template <typename T, typename C, typename A>
+      inline void write(std::string& out, const std::map<std::string, T, C, A>& values);
+
+      // Structs declared with SOCKETIO_STRUCT; socketio_write_fields is found by argument
+      // dependent lookup in the struct's namespace.
+      template <typename T>
+      inline typename std::enable_if<std::is_class<T>::value>::type write(std::string& out, const T& value);
+
+      // Appends s as a quoted JSON string. Runs of characters that need no escaping are
+      // appended in one go.
+      inline void write_string(std::string& out, const char* s, std::size_t length)
+      {
+         static const char hex_digits[] = "0123456789ABCDEF";
+         // 0: as is, 'u': \u00XX, anything else: backslash and that character.
+         static const char escape[256] = {
+#define Z16 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+            'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u', // 00
+            'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u', // 10
+              0,  0,'"',  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 20
+            Z16, Z16,                                                        // 30~4F
+              0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,'\\', 0,  0,  0, // 50
+            Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16                 // 60~FF
+#undef Z16
+         };
+
+         out.reserve(out.size() + length + 2);
+         out.push_back('"');
+         const char* run = s;
+         const char* end = s + length;
+         for (const char* p = s; p != end; ++p)
+         {
+            char e = escape[(unsigned char)*p];
+            if (!e) continue;
+            out.append(run, std::size_t(p - run));
+            out.push_back('\\');
+            out.push_back(e);
+            if (e == 'u')
+            {
+               append_literal(out, "00");
+               out.push_back(hex_digits[(unsigned char)*p >> 4]);
+               out.push_back(hex_digits[(unsigned char)*p & 0xF]);
+            }
+            run = p + 1;
+         }
+         out.append(run, std::size_t(end - run));
+         out.push_back('"');
+      }
+
+      inline void write_unsigned(std::string& out, unsigned long long value)
+      {
+         char digits[20];
+         char* p = digits + sizeof(digits);
+         do
+         {
+            *--p = char('0' + value % 10);
+            value /= 10;
+         } while (value > 0);
+         out.append(p, std::size_t(digits + sizeof(digits) - p));
+      }
+
+      inline void write(std::string& out, bool value)
+      {
+         if (value) append_literal(out, "true");
+         else append_literal(out, "false");
+      }
+
+      template <typename T>
+      inline typename std::enable_if<std::is_integral<T>::value>::type write(std::string& out, T value)
+      {
+         if (value < 0)
+         {
+            out.push_back('-');
+            // Negated as unsigned so that the smallest value doesn't overflow.
+            write_unsigned(out, 0ull - (unsigned long long)(long long)value);
+         }
+         else
+         {
+            write_unsigned(out, (unsigned long long)value);
+         }
+      }
+
+      // Values with at most 9 decimals, like prices, are written as an integer with a
+      // decimal point put in; the smallest scale that divides back to exactly value gives
+      // the shortest such form. Anything else gets the shorter of %.15g and %.17g that reads
+      // back as the same double. JSON has no infinities or NaN; they are written as null.
+      inline void write(std::string& out, double value)
+      {
+         if (!std::isfinite(value))
+         {
+            append_literal(out, "null");
+            return;
+         }
+
+         static const double scales[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+         static const double exact_limit = 9007199254740992.0; // 2^53
+         for (int decimals = 0; decimals < 10; ++decimals)
+         {
+            double scaled = value * scales[decimals];
+            if (std::fabs(scaled) >= exact_limit) break;
+            if (scaled != std::floor(scaled) || scaled / scales[decimals] != value) continue;
+
+            long long n = (long long)scaled;
+            if (n < 0 || (n == 0 && std::signbit(value))) out.push_back('-');
+            unsigned long long magnitude = n < 0 ? 0ull - (unsigned long long)n : (unsigned long long)n;
+            char digits[32];
+            char* p = digits + sizeof(digits);
+            for (int d = 0; d < decimals; ++d)
+            {
+               *--p = char('0' + magnitude % 10);
+               magnitude /= 10;
+            }
+            if (decimals > 0) *--p = '.';
+            do
+            {
+               *--p = char('0' + magnitude % 10);
+               magnitude /= 10;
+            } while (magnitude > 0);
+            out.append(p, std::size_t(digits + sizeof(digits) - p));
+            return;
+         }
+
+         char buffer[32];
+         int length = std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+         if (std::strtod(buffer, NULL) != value) length = std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+         out.append(buffer, std::size_t(length));
+      }
+
+      inline void write(std::string& out, float value)
+      {
+         write(out, double(value));
+      }
+
+      inline void write(std::string& out, const char* value)
+      {
+         if (value) write_string(out, value, std::strlen(value));
+         else append_literal(out, "null");
+      }
+
+      inline void write(std::string& out, const std::string& value)
+      {
+         write_string(out, value.data(), value.size());
+      }
+
+      inline void write(std::string& out, boost::string_ref value)
+      {
+         write_string(out, value.data(), value.size());
+      }
+
+      inline void write(std::string& out, std::nullptr_t)
+      {
+         append_literal(out, "null");
+      }
+
+      template <typename T, typename A>
+      inline void write(std::string& out, const std::vector<T, A>& values)
+      {
+         out.push_back('[');
+         for (typename std::vector<T, A>::const_iterator it = values.begin(); it != values.end(); ++it)
+         {
+            if (it != values.begin()) out.push_back(',');
+            write(out, *it);
+         }
+         out.push_back(']');
+      }
+
+      template <typename T, typename C, typename A>
+      inline void write(std::string& out, const std::map<std::string, T, C, A>& values)
+      {
+         out.push_back('{');
+         for (typename std::map<std::string, T, C, A>::const_iterator it = values.begin(); it != values.end(); ++it)
+         {
+            if (it != values.begin()) out.push_back(',');
+            write_string(out, it->first.data(), it->first.size());
+            out.push_back(':');
+            write(out, it->second);
+         }
+         out.push_back('}');
+      }
+
+      template <typename T>
+      inline typename std::enable_if<std::is_class<T>::value>::type write(std::string& out, const T& value)
+      {
+         out.push_back('{');
+         socketio_write_fields(out, value);
+         out.push_back('}');
+      }
+
+      // Writes the elements of a tuple from I on, comma separated.
+      template <std::size_t I, std::size_t N>
+      struct tuple_writer {
+         template <typename Tuple>
+         static void write(std::string& out, const Tuple& values)
+         {
+            if (I > 0) out.push_back(',');
+            json::write(out, std::get<I>(values));
+            tuple_writer<I + 1, N>::write(out, values);
+         }
+      };
+
+      template <std::size_t N>
+      struct tuple_writer<N, N> {
+         template <typename Tuple>
+         static void write(std::string&, const Tuple&) {}
+      };
+
+   }
+
+   // The arguments of one emit, by reference. Only meant to live for the call it is made for.
+   template <typename... Ts>
+   struct event_args {
+      explicit event_args(const Ts&... v) : values(v...)
+      {}
+
+      std::tuple<const Ts&...> values;
+   };
+
+   template <typename... Ts>
+   inline event_args<Ts...> args(const Ts&... values)
+   {
+      return event_args<Ts...>(values...);
+   }
+
+   namespace json {
+
+      // Appends [arg,...].
+      template <typename... Ts>
+      inline void write(std::string& out, const event_args<Ts...>& args)
+      {
+         out.push_back('[');
+         tuple_writer<0, sizeof...(Ts)>::write(out, args.values);
+         out.push_back(']');
+      }
+
+   }
+
+   namespace json {
+
+      struct value_binder;
+
+      // Where a decoded value goes: the object and the binder for its type.
+      struct value_target
+      {
+         value_target() : object(NULL), binder(NULL)
+         {}
+
+         value_target(void* o, const value_binder* b) : object(o), binder(b)
+         {}
+
+         void* object;
+         const value_binder* binder;
+      };
+
+      // How decoded JSON is stored into one C++ type. Entries the type has no use for are
+      // NULL, and values that would need them are skipped.
+      struct value_binder
+      {
+         void (*set_bool)(void* object, bool value);
+         void (*set_int)(void* object, boost::int64_t value);
+         void (*set_uint)(void* object, boost::uint64_t value);
+         void (*set_double)(void* object, double value);
+         void (*set_string)(void* object, const char* s, std::size_t length);
+         // Objects: finds the member for a key, hashed with hash_name. False for unknown keys.
+         bool (*member)(void* object, boost::uint64_t hash, const char* key, std::size_t length, value_target& out);
+         // Arrays: appends a default element and returns it.
+         value_target (*element)(void* object);
+      };
+
+      // Structs declared with SOCKETIO_STRUCT; socketio_read_field is found by argument
+      // dependent lookup in the struct's namespace.
+      template <typename T, typename Enable = void>
+      struct binder_for {
+         static bool member(void* object, boost::uint64_t hash, const char* key, std::size_t length, value_target& out)
+         {
+            return socketio_read_field(*static_cast<T*>(object), hash, key, length, out);
+         }
+
+         static const value_binder* get()
+         {
+            static const value_binder binder = { NULL, NULL, NULL, NULL, NULL, &member, NULL };
+            return &binder;
+         }
+      };
+
+      template <typename T>
+      inline value_target bind(T& value)
+      {
+         return value_target(&value, binder_for<T>::get());
+      }
+
+      // Numbers convert to the target type as static_cast would.
+      template <typename T>
+      struct binder_for<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+         static void set_int(void* object, boost::int64_t value) { *static_cast<T*>(object) = T(value); }
+         static void set_uint(void* object, boost::uint64_t value) { *static_cast<T*>(object) = T(value); }
+         static void set_double(void* object, double value) { *static_cast<T*>(object) = T(value); }
+
+         static const value_binder* get()
+         {
+            static const value_binder binder = { NULL, &set_int, &set_uint, &set_double, NULL, NULL, NULL };
+            return &binder;
+         }
+      };
+
+      template <>
+      struct binder_for<bool> {
+         static void set_bool(void* object, bool value) { *static_cast<bool*>(object) = value; }
+
+         static const value_binder* get()
+         {
+            static const value_binder binder = { &set_bool, NULL, NULL, NULL, NULL, NULL, NULL };
+            return &binder;
+         }
+      };
+
+      template <>
+      struct binder_for<std::string> {
+         static void set_string(void* object, const char* s, std::size_t length) { static_cast<std::string*>(object)->assign(s, length); }
+
+         static const value_binder* get()
+         {
+            static const value_binder binder = { NULL, NULL, NULL, NULL, &set_string, NULL, NULL };
+            return &binder;
+         }
+      };
+
+      // A view of the decoded string; it is only valid as long as the decoded text is.
+      template <>
+      struct binder_for<boost::string_ref> {
+         static void set_string(void* object, const char* s, std::size_t length) { *static_cast<boost::string_ref*>(object) = boost::string_ref(s, length); }
+
+         static const value_binder* get()
+         {
+            static const value_binder binder = { NULL, NULL, NULL, NULL, &set_string, NULL, NULL };
+            return &binder;
+         }
+      };
+
+      template <typename T, typename A>
+      struct binder_for<std::vector<T, A> > {
+         static value_target element(void* object)
+         {
+            std::vector<T, A>& values = *static_cast<std::vector<T, A>*>(object);
+            values.push_back(T());
+            return bind(values.back());
+         }
+
+         static const value_binder* get()
+         {
+            static const value_binder binder = { NULL, NULL, NULL, NULL, NULL, NULL, &element };
+            return &binder;
+         }
+      };
+
+   }
+
+}
+
+// Declares the fields of a struct for json::write and json::bind, e.g.
+//
+//    struct order { std::string side; double price; int quantity; };
+//    SOCKETIO_STRUCT(order, (side)(price)(quantity))
+//
+// writes {"side":"buy","price":1.5,"quantity":10} and reads it back. Use it in the
+// namespace of the struct, after the struct is complete.
+#define SOCKETIO_STRUCT(type, fields) \
+   inline void socketio_write_fields(std::string& out, const type& value) \
+   { \
+      BOOST_PP_SEQ_FOR_EACH_I(SOCKETIO_STRUCT_FIELD, _, fields) \
+   } \
+   inline bool socketio_read_field(type& value, boost::uint64_t hash, const char* key, std::size_t length, ::socketio::json::value_target& out) \
+   { \
+      switch (hash) \
+      { \
+         BOOST_PP_SEQ_FOR_EACH(SOCKETIO_STRUCT_CASE, _, fields) \
+      } \
+      return false; \
+   }
+
+#define SOCKETIO_STRUCT_FIELD(r, data, i, field) \
+   ::socketio::json::append_literal(out, BOOST_PP_IF(i, ",\"", "\"") BOOST_PP_STRINGIZE(field) "\":"); \
+   ::socketio::json::write(out, value.field);
+
+#define SOCKETIO_STRUCT_CASE(r, data, field) \
+   case ::socketio::hash_literal(BOOST_PP_STRINGIZE(field)): \
+      if (length != sizeof(BOOST_PP_STRINGIZE(field)) - 1 || std::memcmp(key, BOOST_PP_STRINGIZE(field), length) != 0) return false; \
+      out = ::socketio::json::bind(value.field); \
+      return true;
+
+#endif // __SOCKET_IO_SERIALIZE_HPP__
@@ -0,0 +1,276 @@
+/* socket_io_timer_wheel.hpp
+* Hierarchical timing wheel shared by every session on one io_service thread.
+*
+* Heartbeats, disconnect checks and ack deadlines for all sessions on a thread are
+* entries in one wheel, and the wheel is driven by a single asio timer, so the cost
+* per session is a list node instead of a kernel-backed timer. Four levels of 64
+* slots cover 64^4 ticks (about 46 hours at the default 10ms tick); entries further
+* out wait in the top level and are re-filed as the wheel turns.
+*
+* Not thread-safe: schedule, cancel and the callbacks all run on the io thread.
+*/
+
+#ifndef __SOCKET_IO_TIMER_WHEEL_HPP__
+#define __SOCKET_IO_TIMER_WHEEL_HPP__
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/cstdint.hpp>
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace socketio {
+
+   class timing_wheel {
+   public:
+      typedef std::function<void (void)> callback;
+      typedef std::chrono::steady_clock clock;
+      // 0 is never a valid id.
+      typedef boost::uint64_t timer_id;
+
+      explicit timing_wheel(boost::asio::io_service& io_service, clock::duration tick = std::chrono::milliseconds(10)) :
+         m_timer(io_service),
+         m_tick(tick),
+         m_start(clock::now()),
+         m_now_tick(0),
+         m_armed_tick(0),
+         m_armed(false),
+         m_free(-1),
+         m_size(0)
+      {
+         for (int level = 0; level < levels; ++level)
+         {
+            for (int slot = 0; slot < slots; ++slot) m_heads[level][slot] = -1;
+         }
+      }
+
+      ~timing_wheel()
+      {
+         boost::system::error_code ec;
+         m_timer.cancel(ec);
+      }
+
+      // Runs cb on the io thread once delay has passed (rounded up to the next tick).
+      timer_id schedule(clock::duration delay, const callback& cb)
+      {
+         return schedule_at(clock::now() + delay, cb);
+      }
+
+      timer_id schedule_at(clock::time_point when, const callback& cb)
+      {
+         boost::uint64_t expiry = tick_at(when, true);
+         if (expiry <= m_now_tick) expiry = m_now_tick + 1;
+
+         int index = allocate();
+         entry& e = m_entries[index];
+         e.expiry = expiry;
+         e.cb = cb;
+         e.active = true;
+         file(index);
+         ++m_size;
+         arm();
+         return (boost::uint64_t(e.generation) << 32) | boost::uint32_t(index);
+      }
+
+      // Cancels a pending timer. Returns false if it already fired or was cancelled.
+      bool cancel(timer_id id)
+      {
+         int index = int(id & 0xffffffffu);
+         boost::uint32_t generation = boost::uint32_t(id >> 32);
+         if (id == 0 || index >= int(m_entries.size())) return false;
+         entry& e = m_entries[index];
+         if (!e.active || e.generation != generation) return false;
+         unlink(index);
+         release(index);
+         --m_size;
+         return true;
+      }
+
+      // Pending timers.
+      std::size_t size() const { return m_size; }
+
+      // Fires everything due at now. The asio driver calls this; it is public so the wheel
+      // can also be stepped by hand.
+      void advance(clock::time_point now)
+      {
+         boost::uint64_t target = tick_at(now, false);
+         while (m_now_tick < target)
+         {
+            ++m_now_tick;
+            if ((m_now_tick & mask) == 0) cascade();
+            fire(int(m_now_tick & mask));
+         }
+      }
+
+   private:
+      timing_wheel(const timing_wheel&);
+      timing_wheel& operator=(const timing_wheel&);
+
+      static const int levels = 4;
+      static const int bits = 6;
+      static const int slots = 1 << bits;
+      static const boost::uint64_t mask = slots - 1;
+
+      struct entry
+      {
+         entry() : expiry(0), generation(1), prev(-1), next(-1), level(0), slot(0), active(false)
+         {}
+
+         boost::uint64_t expiry;
+         callback cb;
+         boost::uint32_t generation;
+         int prev;
+         int next;
+         int level;
+         int slot;
+         bool active;
+      };
+
+      boost::uint64_t tick_at(clock::time_point when, bool round_up) const
+      {
+         if (when <= m_start) return 0;
+         clock::duration since = when - m_start;
+         boost::uint64_t ticks = boost::uint64_t(since / m_tick);
+         if (round_up && since % m_tick != clock::duration::zero()) ++ticks;
+         return ticks;
+      }
+
+      int allocate()
+      {
+         if (m_free >= 0)
+         {
+            int index = m_free;
+            m_free = m_entries[index].next;
+            return index;
+         }
+         m_entries.push_back(entry());
+         return int(m_entries.size() - 1);
+      }
+
+      void release(int index)
+      {
+         entry& e = m_entries[index];
+         e.cb = callback();
+         e.active = false;
+         ++e.generation;
+         if (e.generation == 0) e.generation = 1;
+         e.prev = -1;
+         e.next = m_free;
+         m_free = index;
+      }
+
+      // Puts an entry in the slot matching its distance from the current tick.
+      void file(int index)
+      {
+         entry& e = m_entries[index];
+         boost::uint64_t expiry = e.expiry < m_now_tick ? m_now_tick : e.expiry;
+         boost::uint64_t delta = expiry - m_now_tick;
+
+         int level = 0;
+         while (level < levels - 1 && delta >= (boost::uint64_t(1) << (bits * (level + 1)))) ++level;
+         // Entries past the top level's range wait in its furthest slot and get re-filed.
+         if (delta >= (boost::uint64_t(1) << (bits * levels))) expiry = m_now_tick + (boost::uint64_t(1) << (bits * levels)) - 1;
+
+         e.level = level;
+         e.slot = int((expiry >> (bits * level)) & mask);
+         e.prev = -1;
+         e.next = m_heads[level][e.slot];
+         if (e.next >= 0) m_entries[e.next].prev = index;
+         m_heads[level][e.slot] = index;
+      }
+
+      void unlink(int index)
+      {
+         entry& e = m_entries[index];
+         if (e.prev >= 0) m_entries[e.prev].next = e.next;
+         else m_heads[e.level][e.slot] = e.next;
+         if (e.next >= 0) m_entries[e.next].prev = e.prev;
+         e.prev = e.next = -1;
+      }
+
+      // Moves the entries of the higher level slots that just came into range down a level.
+      void cascade()
+      {
+         for (int level = 1; level < levels; ++level)
+         {
+            int slot = int((m_now_tick >> (bits * level)) & mask);
+            int index = m_heads[level][slot];
+            m_heads[level][slot] = -1;
+            while (index >= 0)
+            {
+               int next = m_entries[index].next;
+               file(index);
+               index = next;
+            }
+            // Only carry on upwards when this level wrapped too.
+            if (slot != 0) break;
+         }
+      }
+
+      void fire(int slot)
+      {
+         // Pop one entry at a time: callbacks may schedule or cancel other timers.
+         int index;
+         while ((index = m_heads[0][slot]) >= 0)
+         {
+            unlink(index);
+            if (m_entries[index].expiry > m_now_tick)
+            {
+               // Held back from beyond the wheel's range; not due yet.
+               file(index);
+               continue;
+            }
+            callback cb;
+            cb.swap(m_entries[index].cb);
+            release(index);
+            --m_size;
+            cb();
+         }
+      }
+
+      // Level 0 tick the driver has to wake up for next: the first occupied slot of the
+      // current lap, or the end of the lap where the next cascade happens.
+      boost::uint64_t next_wakeup() const
+      {
+         boost::uint64_t lap_end = (m_now_tick | mask) + 1;
+         for (boost::uint64_t t = m_now_tick + 1; t < lap_end; ++t)
+         {
+            if (m_heads[0][t & mask] >= 0) return t;
+         }
+         return lap_end;
+      }
+
+      void arm()
+      {
+         if (m_size == 0) return;
+         boost::uint64_t wake = next_wakeup();
+         if (m_armed && m_armed_tick <= wake) return;
+         m_armed = true;
+         m_armed_tick = wake;
+         m_timer.expires_at(m_start + m_tick * wake);
+         m_timer.async_wait([this](const boost::system::error_code& ec) {
+            if (ec == boost::asio::error::operation_aborted) return;
+            m_armed = false;
+            advance(clock::now());
+            arm();
+         });
+      }
+
+      boost::asio::basic_waitable_timer<clock> m_timer;
+      clock::duration m_tick;
+      clock::time_point m_start;
+      boost::uint64_t m_now_tick;
+      boost::uint64_t m_armed_tick;
+      bool m_armed;
+
+      std::vector<entry> m_entries;
+      int m_heads[levels][slots];
+      int m_free;
+      std::size_t m_size;
+   };
+
+}
+
+#endif // __SOCKET_IO_TIMER_WHEEL_HPP__